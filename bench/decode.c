@@ -0,0 +1,94 @@
+// Decoder microbenchmark: cycle() (predecoded, cached per address) vs. per-step switch decode.
+// Build: cc -O2 -pthread -Isrc bench/decode.c src/chip8.c -o decode-bench
+
+#include "chip8.h"
+
+#include <time.h>
+
+#define DEFAULT_INSTRUCTIONS 20000000ULL
+#define RUNS 5
+
+// Tight loop of ALU, skip, call/return and index ops; never draws or waits
+static const uint16_t program[] = {
+    0x6001, // 200: V0 = 1
+    0x6102, // 202: V1 = 2
+    0x8014, // 204: V0 += V1
+    0x8102, // 206: V1 &= V0
+    0x8203, // 208: V2 ^= V0
+    0x3005, // 20A: skip if V0 == 5
+    0x7301, // 20C: V3 += 1
+    0xA300, // 20E: I = 300
+    0xF31E, // 210: I += V3
+    0x2220, // 212: call 220
+    0x8E06, // 214: VE >>= 1
+    0x4F00, // 216: skip if VF != 0
+    0x1204, // 218: jump 204
+    0x1204, // 21A: jump 204
+    0x0000, // 21C
+    0x0000, // 21E
+    0x8544, // 220: V5 += V4
+    0x00EE, // 222: return
+};
+
+// The pre-table decoder: fetch, run the opcode through the switch, then execute
+static void cycle_switch(struct Chip8 *state) {
+    state->opcode = (state->memory[state->pc] << 8) | state->memory[state->pc + 1];
+    state->pc += 2;
+
+    struct Instruction ins = decode_opcode(state->opcode);
+    ins.execute(state, &ins);
+
+    state->cycles++;
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void load_program(struct Chip8 *state) {
+    uint8_t rom[sizeof(program)];
+
+    for (size_t i = 0; i < sizeof(program) / sizeof(program[0]); i++) {
+        rom[i * 2] = program[i] >> 8;
+        rom[i * 2 + 1] = program[i] & 0xFF;
+    }
+
+    initialise(state);
+    seed_random(state, 1);
+    load_rom_data(state, rom, sizeof(rom));
+}
+
+// Best of RUNS, in ns per instruction
+static double measure(struct Chip8 *state, void (*step)(struct Chip8 *), uint64_t instructions) {
+    double best = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        load_program(state);
+
+        double start = now_seconds();
+        for (uint64_t i = 0; i < instructions; i++) step(state);
+        double ns = (now_seconds() - start) * 1e9 / instructions;
+
+        if (run == 0 || ns < best) best = ns;
+    }
+
+    return best;
+}
+
+int main(int argc, char **argv) {
+    uint64_t instructions = argc > 1 ? strtoull(argv[1], NULL, 0) : DEFAULT_INSTRUCTIONS;
+    struct Chip8 *machine = create_machine(); // Builds the decode table
+
+    double switch_ns = measure(machine, cycle_switch, instructions);
+    double table_ns = measure(machine, cycle, instructions);
+
+    printf("instructions/run: %llu (best of %d)\n", (unsigned long long)instructions, RUNS);
+    printf("switch decode:    %6.2f ns/instruction\n", switch_ns);
+    printf("cycle() decode:   %6.2f ns/instruction\n", table_ns);
+    printf("speedup:          %6.2fx\n", switch_ns / table_ns);
+
+    destroy_machine(machine);
+    return 0;
+}
@@ -0,0 +1,118 @@
+// Environment round-trip benchmark: forks a server process on a shared-memory
+// region and times env_step() from this process, for a few frame counts.
+// 0 frames is pure doorbell and observation overhead.
+// Build: cc -O2 -pthread -Isrc bench/env.c src/env.c src/chip8.c -o env-bench
+// Use:   env-bench [-n STEPS] [ROM]
+
+#include "env.h"
+
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define DEFAULT_STEPS 100000
+#define WARMUP_STEPS 1000
+#define BENCH_REGION "/chip8-env-bench"
+
+// Draws font sprites forever, so every frame changes the display
+static const uint8_t program[] = {
+    0x60, 0x00, // 200: V0 = 0
+    0x61, 0x00, // 202: V1 = 0
+    0xF0, 0x29, // 204: I = font sprite V0
+    0xD0, 0x15, // 206: draw at (V0, V1)
+    0x70, 0x01, // 208: V0 += 1
+    0x12, 0x04, // 20A: jump 204
+};
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void measure(struct EnvRegion *region, uint32_t frames, uint32_t flags, uint64_t *samples, long steps) {
+    for (long i = 0; i < WARMUP_STEPS; i++) env_step(region, 0, frames, flags);
+
+    uint64_t start = now_ns();
+
+    for (long i = 0; i < steps; i++) {
+        uint64_t t0 = now_ns();
+
+        if (!env_step(region, (uint16_t)i, frames, flags)) error("Server went away", true);
+
+        samples[i] = now_ns() - t0;
+    }
+
+    uint64_t total = now_ns() - start;
+
+    qsort(samples, steps, sizeof(uint64_t), compare_u64);
+
+    printf("%6u %-5s %8.2f %8.2f %8.2f %9.2f %10.0f\n", frames, flags & ENV_RGBA ? "rgba" : "bits", samples[steps / 2] / 1e3,
+           samples[steps * 99 / 100] / 1e3, samples[steps * 999 / 1000] / 1e3, samples[steps - 1] / 1e3, steps * 1e9 / total);
+}
+
+int main(int argc, char **argv) {
+    long steps = DEFAULT_STEPS;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n': steps = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: env-bench [-n STEPS] [ROM]\n");
+                return 1;
+        }
+    }
+
+    if (steps < 1) steps = DEFAULT_STEPS;
+
+    const uint8_t *rom = program;
+    size_t rom_size = sizeof(program);
+
+    if (optind < argc) rom = read_rom(argv[optind], &rom_size);
+
+    struct EnvRegion *region = create_env(BENCH_REGION);
+
+    if (region == NULL) return 1;
+
+    pid_t server = fork();
+
+    if (server == 0) {
+        serve_env(region, rom, rom_size, DEFAULT_CYCLES_PER_FRAME, 1);
+        _exit(0);
+    }
+
+    struct EnvRegion *client;
+
+    while ((client = attach_env(BENCH_REGION)) == NULL) usleep(1000);
+
+    uint64_t *samples = (uint64_t *)malloc(steps * sizeof(uint64_t));
+
+    if (samples == NULL) error("Failed to allocate samples", true);
+
+    printf("steps/run: %ld, cpus: %ld\n", steps, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%6s %-5s %8s %8s %8s %9s %10s\n", "frames", "obs", "p50 us", "p99 us", "p99.9 us", "max us", "steps/s");
+
+    measure(client, 0, 0, samples, steps);
+    measure(client, 0, ENV_RGBA, samples, steps);
+    measure(client, 1, 0, samples, steps);
+    measure(client, 1, ENV_RGBA, samples, steps);
+    measure(client, 10, 0, samples, steps);
+
+    env_quit(client);
+    waitpid(server, NULL, 0);
+
+    detach_env(client);
+    destroy_env(region, BENCH_REGION);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,189 @@
+// Generates the synthetic ROMs in bench/roms/, one per opcode class.
+// Build: cc -O2 bench/mkroms.c -o mkroms && ./mkroms bench/roms
+// The ROMs are checked in; rerun this only when changing a program below.
+// Every ROM loops forever and never waits on keys or timers, so cycle()
+// spends its time in the handlers being measured. smc_wrap is not an opcode
+// class but a correctness case for `chip8-batch -e lockstep`.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ROM_START_ADDR 0x200
+#define MAX_ROM_WORDS 1024
+
+struct Rom {
+    uint16_t words[MAX_ROM_WORDS];
+    int count;
+};
+
+static void emit(struct Rom *rom, uint16_t opcode) {
+    if (rom->count == MAX_ROM_WORDS) {
+        fprintf(stderr, "ROM too large\n");
+        exit(1);
+    }
+
+    rom->words[rom->count++] = opcode;
+}
+
+static uint16_t here(const struct Rom *rom) {
+    return ROM_START_ADDR + rom->count * 2;
+}
+
+// 8XYn chains over all eight ALU ops
+static void build_alu(struct Rom *rom) {
+    static const uint8_t ops[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+
+    emit(rom, 0x6013); // V0 = 13
+    emit(rom, 0x6157); // V1 = 57
+
+    for (int i = 0; i < 200; i++) {
+        uint8_t x = 2 + i % 12;
+        uint8_t y = i % 2;
+
+        emit(rom, 0x8000 | x << 8 | y << 4 | ops[i % 9]);
+    }
+
+    emit(rom, 0x1204); // Back to the chain (skip the setup)
+}
+
+// Nested call/return storm: three levels deep per outer call
+static void build_call(struct Rom *rom) {
+    for (int i = 0; i < 32; i++) emit(rom, 0x2000 | (ROM_START_ADDR + 33 * 2)); // Calls to A
+    emit(rom, 0x1200);
+
+    // A: calls B twice; B: calls C; C: returns
+    emit(rom, 0x2000 | (ROM_START_ADDR + 36 * 2)); // 242: call B
+    emit(rom, 0x2000 | (ROM_START_ADDR + 36 * 2)); // 244: call B
+    emit(rom, 0x00EE);                             // 246
+    emit(rom, 0x2000 | (ROM_START_ADDR + 38 * 2)); // 248: B, call C
+    emit(rom, 0x00EE);                             // 24A
+    emit(rom, 0x00EE);                             // 24C: C
+}
+
+// 15-row sprites at fixed positions; `wrap` puts them across both screen edges
+static void build_draw(struct Rom *rom, int wrap) {
+    uint16_t sprite_addr = ROM_START_ADDR + 0x100;
+
+    emit(rom, 0xA000 | sprite_addr);
+
+    for (int i = 0; i < 40; i++) {
+        uint8_t x = wrap ? 58 + i % 6 : (i * 7) % 56;
+        uint8_t y = wrap ? 24 + i % 8 : (i * 3) % 17;
+
+        emit(rom, 0x6000 | x);
+        emit(rom, 0x6100 | y);
+        emit(rom, 0xD01F);
+    }
+
+    emit(rom, 0x1202);
+
+    while (here(rom) < sprite_addr) emit(rom, 0x0000);
+
+    // Checkerboard-ish rows so collisions happen on redraw
+    for (int i = 0; i < 8; i++) emit(rom, i % 2 ? 0x55AA : 0xAA55);
+}
+
+// Bulk FX55/FX65 over all sixteen registers, plus shorter transfers
+static void build_load_store(struct Rom *rom) {
+    for (int i = 0; i < 16; i++) emit(rom, 0x6000 | i << 8 | (i * 17));
+
+    uint16_t loop = here(rom);
+
+    for (int i = 0; i < 16; i++) {
+        emit(rom, 0xA000 | (0x600 + (i % 8) * 0x20));
+        emit(rom, 0xF055 | (i % 2 ? 0xF : 0x7) << 8);
+        emit(rom, 0xF065 | (i % 2 ? 0xF : 0x7) << 8);
+    }
+
+    emit(rom, 0x1000 | loop);
+}
+
+// FX33 on changing values; I stays clear of the program
+static void build_bcd(struct Rom *rom) {
+    emit(rom, 0xA600);
+
+    uint16_t loop = here(rom);
+
+    for (int i = 0; i < 64; i++) {
+        uint8_t x = i % 8;
+
+        emit(rom, 0xF033 | x << 8);
+        emit(rom, 0x7000 | x << 8 | 37);
+    }
+
+    emit(rom, 0x1000 | loop);
+}
+
+static void build_random(struct Rom *rom) {
+    for (int i = 0; i < 128; i++) {
+        emit(rom, 0xC000 | (i % 16) << 8 | (i % 3 ? 0xFF : 0x0F));
+    }
+
+    emit(rom, 0x1200);
+}
+
+// Self-modifying code across the end of memory: each pass, FX55 from I = FFE
+// wraps round to rewrite the 6AKK at 0x000 with a new KK, then runs it, so a
+// translator that misses the wrapped bytes keeps running the stale VA load
+static void build_smc_wrap(struct Rom *rom) {
+    uint16_t loop = here(rom) + 4 * 2; // Past this setup
+    uint16_t jump = 0x1000 | loop;
+
+    emit(rom, 0x6000 | jump >> 8);     // Store "jump loop" at 0x002, after the rewritten word
+    emit(rom, 0x6100 | (jump & 0xFF));
+    emit(rom, 0xA002);
+    emit(rom, 0xF155);
+
+    emit(rom, 0xAFFE);
+    emit(rom, 0x7301); // V3 = next KK
+    emit(rom, 0x626A);
+    emit(rom, 0xF355); // FFE, FFF, then 0x000 = 6A, 0x001 = V3
+    emit(rom, 0x1000);
+}
+
+static void write_rom(const char *dir, const char *name, void (*build)(struct Rom *)) {
+    struct Rom rom = { { 0 }, 0 };
+    char path[1024];
+
+    build(&rom);
+    snprintf(path, sizeof(path), "%s/%s.ch8", dir, name);
+
+    FILE *fp = fopen(path, "wb");
+
+    if (fp == NULL) {
+        perror(path);
+        exit(1);
+    }
+
+    for (int i = 0; i < rom.count; i++) {
+        fputc(rom.words[i] >> 8, fp);
+        fputc(rom.words[i] & 0xFF, fp);
+    }
+
+    fclose(fp);
+    printf("%s: %d bytes\n", path, rom.count * 2);
+}
+
+static void build_draw_aligned(struct Rom *rom) {
+    build_draw(rom, 0);
+}
+
+static void build_draw_wrapping(struct Rom *rom) {
+    build_draw(rom, 1);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = argc > 1 ? argv[1] : "bench/roms";
+
+    write_rom(dir, "alu", build_alu);
+    write_rom(dir, "call", build_call);
+    write_rom(dir, "draw", build_draw_aligned);
+    write_rom(dir, "draw_wrap", build_draw_wrapping);
+    write_rom(dir, "load_store", build_load_store);
+    write_rom(dir, "bcd", build_bcd);
+    write_rom(dir, "random", build_random);
+    write_rom(dir, "smc_wrap", build_smc_wrap);
+
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Opcode-class microbenchmark: runs each synthetic ROM in bench/roms/ through
+// cycle() and reports ns/instruction as JSON (default) or CSV.
+// Build: cc -O2 -pthread -Isrc bench/opcodes.c src/chip8.c -o opcodes-bench
+// Use:   opcodes-bench [-f json|csv] [-n INSTRUCTIONS] [-d ROMDIR] [CLASS...]
+// The ROMs come from bench/mkroms.c.
+
+#include "chip8.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_INSTRUCTIONS 10000000ULL
+#define WARMUP_INSTRUCTIONS 100000ULL
+#define RUNS 5
+
+struct Class {
+    const char *name; // ROM is <dir>/<name>.ch8
+    const char *description;
+};
+
+static const struct Class classes[] = {
+    { "alu",        "8XYn register/ALU chains" },
+    { "call",       "2NNN/00EE call-return storm" },
+    { "draw",       "DXYN 15-row sprites, no wrapping" },
+    { "draw_wrap",  "DXYN 15-row sprites across both edges" },
+    { "load_store", "FX55/FX65 bulk store and load" },
+    { "bcd",        "FX33 BCD" },
+    { "random",     "CXKK random" },
+};
+
+#define CLASS_COUNT (sizeof(classes) / sizeof(classes[0]))
+
+struct Result {
+    const struct Class *class;
+    double best_ns;
+    double median_ns;
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void load(struct Chip8 *state, const uint8_t *rom, size_t size) {
+    initialise(state);
+    seed_random(state, 1);
+    load_rom_data(state, rom, size);
+}
+
+static struct Result measure(struct Chip8 *state, const struct Class *class, const char *dir, uint64_t instructions) {
+    char path[1024];
+    size_t size;
+    double ns[RUNS];
+
+    snprintf(path, sizeof(path), "%s/%s.ch8", dir, class->name);
+    uint8_t *rom = read_rom(path, &size);
+
+    for (int run = 0; run < RUNS; run++) {
+        load(state, rom, size);
+
+        // Fill the instruction cache before timing
+        for (uint64_t i = 0; i < WARMUP_INSTRUCTIONS; i++) cycle(state);
+
+        double start = now_seconds();
+        for (uint64_t i = 0; i < instructions; i++) cycle(state);
+        ns[run] = (now_seconds() - start) * 1e9 / instructions;
+    }
+
+    free(rom);
+    qsort(ns, RUNS, sizeof(double), compare_doubles);
+
+    struct Result result = { class, ns[0], ns[RUNS / 2] };
+    return result;
+}
+
+static bool selected(const struct Class *class, int argc, char **argv) {
+    if (argc == 0) return true;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], class->name) == 0) return true;
+    }
+
+    return false;
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: opcodes-bench [-f json|csv] [-n INSTRUCTIONS] [-d ROMDIR] [CLASS...]\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint64_t instructions = DEFAULT_INSTRUCTIONS;
+    const char *dir = "bench/roms";
+    bool csv = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:n:d:")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (strcmp(optarg, "csv") == 0) csv = true;
+                else if (strcmp(optarg, "json") != 0) usage();
+                break;
+
+            case 'n': instructions = strtoull(optarg, NULL, 0); break;
+            case 'd': dir = optarg; break;
+            default: usage();
+        }
+    }
+
+    if (instructions == 0) usage();
+
+    struct Chip8 *machine = create_machine();
+    struct Result results[CLASS_COUNT];
+    size_t count = 0;
+
+    for (size_t i = 0; i < CLASS_COUNT; i++) {
+        if (selected(&classes[i], argc - optind, argv + optind)) {
+            results[count++] = measure(machine, &classes[i], dir, instructions);
+        }
+    }
+
+    destroy_machine(machine);
+
+    if (csv) {
+        printf("class,description,instructions,runs,best_ns_per_instruction,median_ns_per_instruction\n");
+
+        for (size_t i = 0; i < count; i++) {
+            printf("%s,\"%s\",%llu,%d,%.3f,%.3f\n", results[i].class->name, results[i].class->description,
+                   (unsigned long long)instructions, RUNS, results[i].best_ns, results[i].median_ns);
+        }
+    } else {
+        printf("{\n  \"instructions\": %llu,\n  \"runs\": %d,\n  \"results\": [\n", (unsigned long long)instructions, RUNS);
+
+        for (size_t i = 0; i < count; i++) {
+            printf("    { \"class\": \"%s\", \"description\": \"%s\", \"best_ns_per_instruction\": %.3f, \"median_ns_per_instruction\": %.3f }%s\n",
+                   results[i].class->name, results[i].class->description,
+                   results[i].best_ns, results[i].median_ns, i + 1 < count ? "," : "");
+        }
+
+        printf("  ]\n}\n");
+    }
+
+    return 0;
+}
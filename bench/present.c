@@ -0,0 +1,154 @@
+// Presentation benchmark: present_display() at video scales 1-20 for each
+// kernel this host supports, plain and with scanlines + phosphor persistence.
+// Every kernel's output is checked against the scalar one first.
+// Build: cc -O2 -pthread -Isrc bench/present.c src/present.c src/chip8.c -o present-bench
+// Use:   present-bench [-n FRAMES] [-s MAX_SCALE]
+
+#include "present.h"
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_FRAMES 200
+#define DEFAULT_MAX_SCALE 20
+#define PATTERNS 16 // Distinct displays cycled through, so fading always has work
+
+static const char *targets[] = { "scalar", "sse2", "avx2" };
+
+#define TARGET_COUNT (sizeof(targets) / sizeof(targets[0]))
+
+static uint64_t patterns[PATTERNS][SCREEN_HEIGHT];
+
+static double now_seconds() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void make_patterns() {
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+
+    for (int p = 0; p < PATTERNS; p++) {
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            patterns[p][y] = x;
+        }
+    }
+}
+
+static void setup(struct Presenter *presenter, int scale, bool effects, const char *target) {
+    initialise_presenter(presenter, scale, 0x33FF66FF, 0x101010FF, effects, effects ? 200 : 0);
+    set_presenter_target(presenter, target);
+}
+
+// Same frames through `target` and through the scalar kernels must give the same pixels
+static bool matches_scalar(const char *target, int scale, bool effects, uint32_t *pixels, uint32_t *reference) {
+    static struct Presenter presenter;
+    static struct Presenter scalar;
+    int pitch = SCREEN_WIDTH * scale * sizeof(uint32_t);
+    size_t bytes = (size_t)pitch * SCREEN_HEIGHT * scale;
+
+    setup(&presenter, scale, effects, target);
+    setup(&scalar, scale, effects, "scalar");
+
+    for (int f = 0; f < PATTERNS; f++) {
+        present_display(&presenter, patterns[f], pixels, pitch);
+        present_display(&scalar, patterns[f], reference, pitch);
+
+        if (memcmp(pixels, reference, bytes) != 0) return false;
+    }
+
+    return true;
+}
+
+static double time_frames(const char *target, int scale, bool effects, uint32_t *pixels, int frames) {
+    static struct Presenter presenter;
+    int pitch = SCREEN_WIDTH * scale * sizeof(uint32_t);
+
+    setup(&presenter, scale, effects, target);
+
+    for (int f = 0; f < PATTERNS; f++) present_display(&presenter, patterns[f], pixels, pitch); // Warm up
+
+    double start = now_seconds();
+
+    for (int f = 0; f < frames; f++) present_display(&presenter, patterns[f % PATTERNS], pixels, pitch);
+
+    return (now_seconds() - start) * 1e6 / frames;
+}
+
+int main(int argc, char **argv) {
+    int frames = DEFAULT_FRAMES;
+    int max_scale = DEFAULT_MAX_SCALE;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+            case 'n': frames = atoi(optarg); break;
+            case 's': max_scale = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: present-bench [-n FRAMES] [-s MAX_SCALE]\n");
+                return 1;
+        }
+    }
+
+    if (frames < 1 || max_scale < 1 || max_scale > MAX_VIDEO_SCALE) return 1;
+
+    size_t bytes = (size_t)SCREEN_SIZE * max_scale * max_scale * sizeof(uint32_t);
+    uint32_t *pixels = (uint32_t *)aligned_alloc(64, bytes);
+    uint32_t *reference = (uint32_t *)aligned_alloc(64, bytes);
+
+    if (pixels == NULL || reference == NULL) error("Failed to allocate frame buffers", true);
+
+    make_patterns();
+
+    // Which kernels this host can run
+    bool available[TARGET_COUNT];
+    struct Presenter probe;
+
+    initialise_presenter(&probe, 1, 0xFFFFFFFF, 0x000000FF, false, 0);
+
+    for (size_t t = 0; t < TARGET_COUNT; t++) available[t] = set_presenter_target(&probe, targets[t]);
+
+    for (size_t t = 1; t < TARGET_COUNT; t++) {
+        if (!available[t]) continue;
+
+        for (int scale = 1; scale <= max_scale; scale++) {
+            for (int effects = 0; effects < 2; effects++) {
+                if (!matches_scalar(targets[t], scale, effects, pixels, reference)) {
+                    fprintf(stderr, "%s differs from scalar at scale %d%s\n", targets[t], scale, effects ? " with effects" : "");
+                    return 1;
+                }
+            }
+        }
+    }
+
+    printf("us/frame (%d frames), effects = scanlines + persistence\n", frames);
+    printf("%5s %9s", "scale", "pixels");
+
+    for (size_t t = 0; t < TARGET_COUNT; t++) {
+        if (available[t]) printf(" %9s %9s", targets[t], "+effects");
+    }
+
+    printf("\n");
+
+    for (int scale = 1; scale <= max_scale; scale++) {
+        printf("%5d %9d", scale, SCREEN_SIZE * scale * scale);
+
+        for (size_t t = 0; t < TARGET_COUNT; t++) {
+            if (!available[t]) continue;
+
+            printf(" %9.2f %9.2f", time_frames(targets[t], scale, false, pixels, frames),
+                   time_frames(targets[t], scale, true, pixels, frames));
+        }
+
+        printf("\n");
+    }
+
+    free(pixels);
+    free(reference);
+    return 0;
+}
@@ -0,0 +1,283 @@
+// Ahead-of-time ROM-to-C translator. Walks a ROM from ROM_START_ADDR, finds the
+// reachable code and writes a C translation unit exposing
+//     uint64_t run_compiled(struct Chip8 *state, uint64_t budget);
+//     void run_frame_compiled(struct Chip8 *state);
+//     void cycle_compiled(struct Chip8 *state);
+// which behave like run_cycles()/run_frame()/cycle() but need no JIT runtime
+// or RWX memory.
+//
+// Build: cc -O2 -pthread src/aot.c src/chip8.c -o chip8-aot
+// Use:   chip8-aot game.ch8 game.c && cc -O2 -shared -fPIC -Isrc game.c -o game.so
+// The shared object resolves the core (cycle(), handlers, decode_table) from the
+// host, so the host must be linked with -rdynamic.
+
+#include "chip8.h"
+#include "jit.h"
+
+#include <string.h>
+
+struct Translation {
+    const uint8_t *rom;
+    size_t size;
+
+    bool block_start[MEMORY_SIZE];
+
+    uint16_t worklist[MEMORY_SIZE];
+    int pending;
+};
+
+static bool in_rom(const struct Translation *t, int addr) {
+    return addr >= ROM_START_ADDR && addr + 1 < ROM_START_ADDR + (int)t->size;
+}
+
+static uint16_t opcode_at(const struct Translation *t, uint16_t addr) {
+    return (t->rom[addr - ROM_START_ADDR] << 8) | t->rom[addr - ROM_START_ADDR + 1];
+}
+
+static void add_entry(struct Translation *t, int addr) {
+    if (!in_rom(t, addr) || t->block_start[addr]) return;
+
+    t->block_start[addr] = true;
+    t->worklist[t->pending++] = addr;
+}
+
+static bool is_skip(Handler h) {
+    return h == &OP_3XKK || h == &OP_4XKK || h == &OP_5XY0 || h == &OP_9XY0 ||
+           h == &OP_EX9E || h == &OP_EXA1;
+}
+
+static bool ends_block(Handler h) {
+    return is_skip(h) || h == &OP_1NNN || h == &OP_2NNN || h == &OP_00EE || h == &OP_BNNN ||
+           h == &OP_FX0A || h == &OP_FX33 || h == &OP_FX55;
+}
+
+// Number of instructions in the block starting at `start`
+static int block_length(const struct Translation *t, uint16_t start) {
+    int length = 0;
+
+    for (uint16_t addr = start; in_rom(t, addr) && length < JIT_MAX_BLOCK; addr += 2) {
+        length++;
+        if (ends_block(decode_opcode(opcode_at(t, addr)).execute)) break;
+    }
+
+    return length;
+}
+
+// Reachability: follow every static successor. BNNN targets, returns and anything
+// else computed at run time are left to the interpreter fallback.
+static void discover(struct Translation *t) {
+    add_entry(t, ROM_START_ADDR);
+
+    while (t->pending > 0) {
+        uint16_t start = t->worklist[--t->pending];
+        int length = block_length(t, start);
+        uint16_t last = start + (length - 1) * 2;
+        struct Instruction ins = decode_opcode(opcode_at(t, last));
+        Handler h = ins.execute;
+
+        if (h == &OP_1NNN) {
+            add_entry(t, ins.nnn);
+        } else if (h == &OP_2NNN) {
+            add_entry(t, ins.nnn);
+            add_entry(t, last + 2);
+        } else if (h == &OP_BNNN) {
+            add_entry(t, ins.nnn);
+        } else if (is_skip(h)) {
+            add_entry(t, last + 2);
+            add_entry(t, last + 4);
+        } else if (h != &OP_00EE) {
+            add_entry(t, last + 2);
+        }
+    }
+}
+
+// Leaves the block for `target`
+static void emit_exit(FILE *out, const struct Translation *t, uint16_t target, const char *indent) {
+    fprintf(out, "%sstate->pc = 0x%03X;\n", indent, target);
+
+    if (target < MEMORY_SIZE && t->block_start[target]) fprintf(out, "%sgoto block_%03X;\n", indent, target);
+    else fprintf(out, "%scontinue;\n", indent);
+}
+
+static void emit_handler_call(FILE *out, uint16_t addr, uint16_t opcode, const char *name) {
+    fprintf(out, "    state->pc = 0x%03X;\n", addr + 2);
+    fprintf(out, "    %s(state, &decode_table[0x%04X]);\n", name, opcode);
+}
+
+static void emit_add_cycles(FILE *out, int count) {
+    if (count > 0) fprintf(out, "    state->cycles += %d;\n", count);
+}
+
+static void emit_block(FILE *out, const struct Translation *t, uint16_t start) {
+    int length = block_length(t, start);
+
+    // Guard: budget left, and the bytes still match the ROM (self-modifying code)
+    fprintf(out, "block_%03X:\n", start);
+    fprintf(out, "    if (end - state->cycles < %d || memcmp(state->memory + 0x%03X, rom + 0x%03X, %d) != 0) goto interpret;\n",
+            length, start, start - ROM_START_ADDR, length * 2);
+
+    int pending_cycles = 0; // Instructions not yet added to state->cycles
+
+    for (int i = 0; i < length; i++) {
+        uint16_t addr = start + i * 2;
+        uint16_t opcode = opcode_at(t, addr);
+        struct Instruction ins = decode_opcode(opcode);
+        Handler h = ins.execute;
+        bool last = i == length - 1;
+
+        fprintf(out, "    // %03X: %04X\n", addr, opcode);
+
+        // Settle the count before a timer op, and before the block's exit
+        if (reads_cycles(&ins, addr)) {
+            emit_add_cycles(out, pending_cycles);
+            pending_cycles = 0;
+        } else if (last) {
+            emit_add_cycles(out, pending_cycles + 1);
+            pending_cycles = -1;
+        }
+
+        if (may_idle(&ins, addr)) {
+            // Back through dispatch, which refreshes run_stop before the next skip
+            emit_handler_call(out, addr, opcode, "OP_1NNN");
+            emit_add_cycles(out, 1);
+            fprintf(out, "    continue;\n");
+            return;
+        }
+
+        if (h == &OP_1NNN) {
+            emit_exit(out, t, ins.nnn, "    ");
+            return;
+        }
+
+        if (h == &OP_2NNN) {
+            emit_handler_call(out, addr, opcode, "OP_2NNN");
+            emit_exit(out, t, ins.nnn, "    ");
+            return;
+        }
+
+        if (h == &OP_3XKK || h == &OP_4XKK || h == &OP_5XY0 || h == &OP_9XY0) {
+            if (h == &OP_3XKK)      fprintf(out, "    if (V[%d] == 0x%02X) {\n", ins.x, ins.kk);
+            else if (h == &OP_4XKK) fprintf(out, "    if (V[%d] != 0x%02X) {\n", ins.x, ins.kk);
+            else if (h == &OP_5XY0) fprintf(out, "    if (V[%d] == V[%d]) {\n", ins.x, ins.y);
+            else                    fprintf(out, "    if (V[%d] != V[%d]) {\n", ins.x, ins.y);
+
+            emit_exit(out, t, addr + 4, "        ");
+            fprintf(out, "    }\n");
+            emit_exit(out, t, addr + 2, "    ");
+            return;
+        }
+
+        if (h == &OP_6XKK) {
+            fprintf(out, "    V[%d] = 0x%02X;\n", ins.x, ins.kk);
+        } else if (h == &OP_7XKK) {
+            fprintf(out, "    V[%d] += 0x%02X;\n", ins.x, ins.kk);
+        } else if (h == &OP_8XY0) {
+            fprintf(out, "    V[%d] = V[%d];\n", ins.x, ins.y);
+        } else if (h == &OP_8XY1) {
+            fprintf(out, "    V[%d] |= V[%d];\n", ins.x, ins.y);
+        } else if (h == &OP_8XY2) {
+            fprintf(out, "    V[%d] &= V[%d];\n", ins.x, ins.y);
+        } else if (h == &OP_8XY3) {
+            fprintf(out, "    V[%d] ^= V[%d];\n", ins.x, ins.y);
+        } else if (h == &OP_8XY4) {
+            fprintf(out, "    { uint16_t sum = V[%d] + V[%d]; V[15] = sum > 255; V[%d] = sum & 0xFF; }\n", ins.x, ins.y, ins.x);
+        } else if (h == &OP_8XY5) {
+            fprintf(out, "    V[15] = V[%d] > V[%d]; V[%d] = V[%d] - V[%d];\n", ins.x, ins.y, ins.x, ins.x, ins.y);
+        } else if (h == &OP_8XY6) {
+            fprintf(out, "    V[15] = V[%d] & 0x1; V[%d] >>= 1;\n", ins.x, ins.x);
+        } else if (h == &OP_8XY7) {
+            fprintf(out, "    V[15] = V[%d] > V[%d]; V[%d] = V[%d] - V[%d];\n", ins.y, ins.x, ins.x, ins.y, ins.x);
+        } else if (h == &OP_8XYE) {
+            fprintf(out, "    V[15] = (V[%d] & 0x80) >> 7; V[%d] <<= 1;\n", ins.x, ins.x);
+        } else if (h == &OP_ANNN) {
+            fprintf(out, "    state->index = 0x%03X;\n", ins.nnn);
+        } else {
+            emit_handler_call(out, addr, opcode, handler_name(h));
+        }
+
+        pending_cycles++;
+
+        if (last) {
+            emit_add_cycles(out, pending_cycles);
+
+            // Handlers that set PC themselves (returns, BNNN, FX0A) go back through dispatch
+            if (ends_block(h)) fprintf(out, "    continue;\n");
+            else emit_exit(out, t, addr + 2, "    ");
+        }
+    }
+}
+
+static void emit_translation(FILE *out, const struct Translation *t, const char *rom_name) {
+    fprintf(out, "// Generated by chip8-aot from %s. Do not edit.\n\n", rom_name);
+    fprintf(out, "#include \"chip8.h\"\n\n#include <string.h>\n\n");
+    fprintf(out, "#define V state->registers\n\n");
+
+    fprintf(out, "static const uint8_t rom[%zu] = {", t->size);
+    for (size_t i = 0; i < t->size; i++) fprintf(out, "%s0x%02X,", i % 16 ? " " : "\n    ", t->rom[i]);
+    fprintf(out, "\n};\n\n");
+
+    fprintf(out, "uint64_t run_compiled(struct Chip8 *state, uint64_t budget) {\n");
+    fprintf(out, "    uint64_t end = state->cycles + budget;\n\n");
+    fprintf(out, "    while (state->cycles < end) {\n");
+    fprintf(out, "        dispatch_events(state);\n");
+    fprintf(out, "        update_run_stop(state, end);\n\n");
+    fprintf(out, "        switch (state->pc) {\n");
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (t->block_start[addr]) fprintf(out, "            case 0x%03X: goto block_%03X;\n", addr, addr);
+    }
+    fprintf(out, "            default: break;\n");
+    fprintf(out, "        }\n\n");
+
+    // Untranslated PC, stale code or a short budget: one interpreted step
+    fprintf(out, "    interpret:\n");
+    fprintf(out, "        if (state->cycles >= end) break;\n");
+    fprintf(out, "        cycle(state);\n");
+    fprintf(out, "        continue;\n\n");
+
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (t->block_start[addr]) {
+            emit_block(out, t, addr);
+            fprintf(out, "\n");
+        }
+    }
+
+    fprintf(out, "    }\n\n");
+    fprintf(out, "    return budget;\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "void run_frame_compiled(struct Chip8 *state) {\n");
+    fprintf(out, "    run_compiled(state, state->cycles_per_frame);\n");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "void cycle_compiled(struct Chip8 *state) {\n");
+    fprintf(out, "    run_compiled(state, 1);\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: chip8-aot ROM OUTPUT.c\n");
+        return 1;
+    }
+
+    struct Translation *t = (struct Translation *)calloc(1, sizeof(struct Translation));
+
+    t->rom = read_rom(argv[1], &t->size);
+
+    discover(t);
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) error("Failed to open output file", true);
+
+    emit_translation(out, t, argv[1]);
+    fclose(out);
+
+    int blocks = 0;
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) blocks += t->block_start[addr];
+    fprintf(stderr, "%s: %d blocks translated\n", argv[1], blocks);
+
+    free((void *)t->rom);
+    free(t);
+
+    return 0;
+}
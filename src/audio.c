@@ -0,0 +1,132 @@
+#include "audio.h"
+
+#include <string.h>
+
+#define WAV_HEADER_BYTES 44
+
+void initialise_beeper(struct Beeper *beeper, uint32_t sample_rate, unsigned int frequency, int16_t amplitude) {
+    memset(beeper, 0, sizeof(*beeper));
+
+    beeper->sample_rate = sample_rate;
+    beeper->amplitude = amplitude;
+    beeper->step = (uint32_t)(((uint64_t)frequency << 32) / sample_rate);
+}
+
+bool push_beeper_event(struct Beeper *beeper, uint64_t sample, bool on) {
+    uint32_t head = beeper->head;
+
+    if (head - __atomic_load_n(&beeper->tail, __ATOMIC_ACQUIRE) == BEEPER_RING_SIZE) return false;
+
+    beeper->events[head & (BEEPER_RING_SIZE - 1)].sample = sample;
+    beeper->events[head & (BEEPER_RING_SIZE - 1)].on = on;
+    __atomic_store_n(&beeper->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+uint64_t beeper_position(const struct Beeper *beeper) {
+    return __atomic_load_n(&beeper->position, __ATOMIC_ACQUIRE);
+}
+
+static void render_span(struct Beeper *beeper, int16_t *out, int count) {
+    if (!beeper->on) {
+        memset(out, 0, count * sizeof(int16_t));
+        return;
+    }
+
+    int16_t high = beeper->amplitude;
+    uint32_t phase = beeper->phase;
+
+    for (int i = 0; i < count; i++) {
+        out[i] = (phase & 0x80000000) ? -high : high;
+        phase += beeper->step;
+    }
+
+    beeper->phase = phase;
+}
+
+void render_beeper(struct Beeper *beeper, int16_t *out, int count) {
+    uint64_t start = beeper->position;
+    int done = 0;
+
+    while (done < count) {
+        uint32_t tail = beeper->tail;
+        int until = count;
+        bool due = tail != __atomic_load_n(&beeper->head, __ATOMIC_ACQUIRE);
+        const struct BeeperEvent *event = &beeper->events[tail & (BEEPER_RING_SIZE - 1)];
+
+        if (due && event->sample < start + count) {
+            until = event->sample > start + done ? (int)(event->sample - start) : done;
+        } else {
+            due = false;
+        }
+
+        render_span(beeper, out + done, until - done);
+        done = until;
+
+        if (!due) break;
+
+        if (event->on && !beeper->on) beeper->phase = 0; // Every beep starts the same way
+        beeper->on = event->on;
+        __atomic_store_n(&beeper->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&beeper->position, start + count, __ATOMIC_RELEASE);
+}
+
+static void put_u16(FILE *fp, uint16_t value) {
+    fputc(value & 0xFF, fp);
+    fputc(value >> 8, fp);
+}
+
+static void put_u32(FILE *fp, uint32_t value) {
+    put_u16(fp, value & 0xFFFF);
+    put_u16(fp, value >> 16);
+}
+
+static void write_wav_header(struct WavWriter *wav) {
+    uint32_t data_bytes = (uint32_t)(wav->samples * sizeof(int16_t));
+
+    fwrite("RIFF", 1, 4, wav->fp);
+    put_u32(wav->fp, WAV_HEADER_BYTES - 8 + data_bytes);
+    fwrite("WAVEfmt ", 1, 8, wav->fp);
+    put_u32(wav->fp, 16);                        // fmt chunk size
+    put_u16(wav->fp, 1);                         // PCM
+    put_u16(wav->fp, 1);                         // Mono
+    put_u32(wav->fp, wav->sample_rate);
+    put_u32(wav->fp, wav->sample_rate * sizeof(int16_t)); // Bytes per second
+    put_u16(wav->fp, sizeof(int16_t));           // Bytes per frame
+    put_u16(wav->fp, 16);                        // Bits per sample
+    fwrite("data", 1, 4, wav->fp);
+    put_u32(wav->fp, data_bytes);
+}
+
+bool open_wav(struct WavWriter *wav, const char *filename, uint32_t sample_rate) {
+    wav->sample_rate = sample_rate;
+    wav->samples = 0;
+
+    if ((wav->fp = fopen(filename, "wb")) == NULL) {
+        error("Failed to open WAV file", false);
+        return false;
+    }
+
+    write_wav_header(wav); // Sizes are rewritten on close
+    return true;
+}
+
+void write_wav(struct WavWriter *wav, const int16_t *samples, size_t count) {
+    for (size_t i = 0; i < count; i++) put_u16(wav->fp, (uint16_t)samples[i]);
+
+    wav->samples += count;
+}
+
+bool close_wav(struct WavWriter *wav) {
+    bool ok = fseek(wav->fp, 0, SEEK_SET) == 0;
+
+    if (ok) write_wav_header(wav);
+    if (ferror(wav->fp)) ok = false;
+    if (fclose(wav->fp) != 0) ok = false;
+    if (!ok) error("Failed to write WAV file", false);
+
+    wav->fp = NULL;
+    return ok;
+}
@@ -0,0 +1,60 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "chip8.h"
+
+// Beeper: a square-wave generator driven by "on/off at sample T" events. The
+// emulator thread turns the core's EVENT_SOUND_ON/OFF into events and pushes
+// them through a single-producer single-consumer ring; the audio callback
+// renders from it and switches at the exact sample. Rendering takes no lock
+// and allocates nothing, so it is safe on a real-time audio thread.
+
+#define DEFAULT_SAMPLE_RATE 48000
+#define DEFAULT_AUDIO_SAMPLES 256 // Per callback: 5.3 ms at 48 kHz
+#define MIN_AUDIO_SAMPLES 128
+#define BEEPER_HZ 440
+#define BEEPER_AMPLITUDE 6000
+
+struct BeeperEvent {
+    uint64_t sample; // Output sample index the change takes effect at
+    bool on;
+};
+
+#define BEEPER_RING_SIZE 256 // Power of two
+
+struct Beeper {
+    _Alignas(64) uint32_t head; // Next event slot to write, owned by the producer
+    _Alignas(64) uint32_t tail; // Next event slot to read, owned by the renderer
+    struct BeeperEvent events[BEEPER_RING_SIZE];
+
+    // Renderer's; `position` is also read by the producer
+    _Alignas(64) uint64_t position; // Samples rendered so far
+    bool on;
+    uint32_t phase; // Square wave phase, top bit is the output level
+    uint32_t step;  // Phase advance per sample
+
+    uint32_t sample_rate;
+    int16_t amplitude;
+};
+
+void initialise_beeper(struct Beeper *beeper, uint32_t sample_rate, unsigned int frequency, int16_t amplitude);
+
+// Producer. Events must come in sample order; returns false (dropping it) if the ring is full.
+bool push_beeper_event(struct Beeper *beeper, uint64_t sample, bool on);
+uint64_t beeper_position(const struct Beeper *beeper); // Samples rendered, for scheduling ahead of playback
+
+// Renderer: the next `count` mono samples. Events already due play from the first sample.
+void render_beeper(struct Beeper *beeper, int16_t *out, int count);
+
+// 16-bit mono WAV output; the header sizes are filled in by close_wav()
+struct WavWriter {
+    FILE *fp;
+    uint32_t sample_rate;
+    uint64_t samples;
+};
+
+bool open_wav(struct WavWriter *wav, const char *filename, uint32_t sample_rate);
+void write_wav(struct WavWriter *wav, const int16_t *samples, size_t count);
+bool close_wav(struct WavWriter *wav);
+
+#endif
@@ -0,0 +1,529 @@
+// Headless batch runner: steps many machines across worker threads, no SDL required.
+// Build: cc -O2 -pthread -rdynamic src/batch.c src/chip8.c src/jit.c src/lanes.c -ldl -o chip8-batch
+
+#include "chip8.h"
+#include "jit.h"
+#include "lanes.h"
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+enum Engine {
+    ENGINE_INTERPRETER,
+    ENGINE_JIT,
+    ENGINE_LOCKSTEP, // JIT checked against the interpreter after every block
+    ENGINE_COMPILED, // ROM translated ahead of time by chip8-aot
+    ENGINE_LANES,    // Up to LANE_BATCH machines per worker stepped together by lanes.c
+};
+
+#define LANE_BATCH 1024
+
+typedef uint64_t (*RunCompiled)(struct Chip8 *state, uint64_t budget);
+
+struct Rom {
+    const char *filename;
+    uint8_t *data;
+    size_t size;
+};
+
+struct Job {
+    const struct Rom *rom;
+    unsigned int seed;
+
+    // Results, filled in by whichever worker ran the job
+    uint64_t cycles;
+    double seconds;
+    uint64_t display_hash;
+    uint64_t mismatches;
+    uint64_t idle_skips;
+    uint64_t idle_cycles;
+
+    uint8_t registers[16];
+    uint16_t index;
+    uint16_t pc;
+    uint8_t sp;
+};
+
+// Per-worker job queue. The owner pops from the tail, thieves take from the head.
+struct Deque {
+    pthread_mutex_t lock;
+    int *jobs;
+    int head;
+    int tail;
+};
+
+// One set of lanes run by run_lane_jobs(): its machines finish together, so
+// throughput is only meaningful for the group as a whole
+struct LaneRun {
+    int machines;
+    uint64_t cycles;
+    double seconds;
+};
+
+struct Batch;
+
+struct Worker {
+    pthread_t thread;
+    int id;
+    unsigned int victim_seed;
+
+    struct Deque deque;
+    struct Batch *batch;
+
+    // Lanes statistics, summed over every chunk this worker ran
+    uint64_t lane_steps;
+    uint64_t lane_diverged_steps;
+    uint64_t lane_vector_instructions;
+    uint64_t lane_scalar_instructions;
+    const char *lane_target;
+
+    struct LaneRun *lane_runs;
+    int lane_run_count;
+};
+
+struct Batch {
+    struct Job *jobs;
+    int job_count;
+
+    struct Worker *workers;
+    int worker_count;
+
+    uint64_t cycle_budget;
+    uint64_t cycles_per_frame;
+    enum Engine engine;
+    RunCompiled run_compiled;
+    int lane_chunk; // Most jobs one run_lane_jobs() takes: a worker's share, in whole groups
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t hash_display(const struct Chip8 *state) {
+    // FNV-1a over the raw display bytes
+    const uint8_t *bytes = (const uint8_t *)state->display;
+    uint64_t hash = 0xCBF29CE484222325ULL;
+
+    for (size_t i = 0; i < sizeof(state->display); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+static bool pop_job(struct Deque *deque, int *job) {
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        *job = deque->jobs[--deque->tail];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+static bool steal_job(struct Deque *deque, int *job) {
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail > deque->head) {
+        *job = deque->jobs[deque->head++];
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return found;
+}
+
+static bool next_job(struct Worker *worker, int *job) {
+    struct Batch *batch = worker->batch;
+
+    if (pop_job(&worker->deque, job)) return true;
+
+    // Own queue is empty, so try every other worker starting from a random victim.
+    // Jobs never spawn jobs, so once a full sweep finds nothing the batch is drained.
+    int start = rand_r(&worker->victim_seed) % batch->worker_count;
+
+    for (int i = 0; i < batch->worker_count; i++) {
+        struct Worker *victim = &batch->workers[(start + i) % batch->worker_count];
+
+        if (victim == worker) continue;
+        if (steal_job(&victim->deque, job)) return true;
+    }
+
+    return false;
+}
+
+// Steps one engine for `count` instructions; returns lockstep mismatches
+static uint64_t run_engine(struct Batch *batch, struct Chip8 *machine, struct Jit *jit, struct Chip8 *shadow, uint64_t count) {
+    switch (batch->engine) {
+        case ENGINE_INTERPRETER:
+            run_cycles(machine, count);
+            break;
+
+        case ENGINE_JIT:
+            run_jit(jit, machine, count);
+            break;
+
+        case ENGINE_LOCKSTEP:
+            return run_jit_lockstep(jit, machine, shadow, count);
+
+        case ENGINE_COMPILED:
+            batch->run_compiled(machine, count);
+            break;
+
+        case ENGINE_LANES:
+            break; // Run a chunk at a time by run_lane_jobs()
+    }
+
+    return 0;
+}
+
+static void setup_job(struct Batch *batch, struct Chip8 *machine, const struct Job *job) {
+    initialise(machine);
+    seed_random(machine, job->seed);
+    machine->cycles_per_frame = batch->cycles_per_frame;
+    load_rom_data(machine, job->rom->data, job->rom->size);
+}
+
+static void finish_job(struct Batch *batch, struct Chip8 *machine, struct Job *job, double seconds) {
+    job->seconds = seconds;
+    job->cycles = batch->cycle_budget;
+    job->display_hash = hash_display(machine);
+    job->idle_skips = machine->idle_skips;
+    job->idle_cycles = machine->idle_cycles;
+
+    memcpy(job->registers, machine->registers, sizeof(job->registers));
+    job->index = machine->index;
+    job->pc = machine->pc;
+    job->sp = machine->sp;
+}
+
+static void run_job(struct Batch *batch, struct Chip8 *machine, struct Jit *jit, struct Chip8 *shadow, struct Job *job) {
+    setup_job(batch, machine, job);
+
+    double start = now_seconds();
+
+    // Timers follow the instruction count, so the whole budget runs in one go
+    job->mismatches = run_engine(batch, machine, jit, shadow, batch->cycle_budget);
+
+    finish_job(batch, machine, job, now_seconds() - start);
+}
+
+// Steps `count` machines of one ROM as a set of lanes and records the run
+static void run_lane_group(struct Worker *worker, struct Chip8 **machines, const int *jobs, int count) {
+    struct Batch *batch = worker->batch;
+    struct Lanes *lanes = create_lanes(machines, count);
+    double start = now_seconds();
+
+    run_lanes(lanes, batch->cycle_budget);
+
+    double seconds = now_seconds() - start;
+
+    for (int i = 0; i < count; i++) finish_job(batch, machines[i], &batch->jobs[jobs[i]], seconds);
+
+    struct LaneRun *runs = (struct LaneRun *)realloc(worker->lane_runs, (worker->lane_run_count + 1) * sizeof(struct LaneRun));
+
+    if (runs == NULL) error("Failed to record lane group", true);
+
+    worker->lane_runs = runs;
+    worker->lane_runs[worker->lane_run_count++] = (struct LaneRun){ count, batch->cycle_budget * count, seconds };
+
+    worker->lane_steps += lanes->steps;
+    worker->lane_diverged_steps += lanes->diverged_steps;
+    worker->lane_vector_instructions += lanes->vector_instructions;
+    worker->lane_scalar_instructions += lanes->scalar_instructions;
+    worker->lane_target = lanes->target;
+
+    destroy_lanes(lanes);
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+// Takes up to lane_chunk jobs and steps them as one set of lanes; false once none
+// are left. Machines are created as slots are first needed, so small batches
+// don't pay for LANE_BATCH of them.
+static bool run_lane_jobs(struct Worker *worker, struct Chip8 **machines) {
+    struct Batch *batch = worker->batch;
+    int jobs[LANE_BATCH];
+    int count = 0;
+
+    while (count < batch->lane_chunk && next_job(worker, &jobs[count])) count++;
+
+    if (count == 0) return false;
+
+    // Jobs are numbered ROM by ROM, so sorting puts each ROM's jobs together
+    qsort(jobs, count, sizeof(int), compare_ints);
+
+    for (int i = 0; i < count; i++) {
+        if (machines[i] == NULL) machines[i] = create_machine();
+    }
+
+    // One set of lanes per ROM: mixing ROMs in a LaneGroup splits its PCs at once
+    for (int first = 0, last; first < count; first = last) {
+        const struct Rom *rom = batch->jobs[jobs[first]].rom;
+
+        for (last = first + 1; last < count && batch->jobs[jobs[last]].rom == rom; last++);
+
+        // Fork copies of the ROM off the first, so the lanes share memory and decode once
+        setup_job(batch, machines[first], &batch->jobs[jobs[first]]);
+
+        for (int i = first + 1; i < last; i++) {
+            copy_machine(machines[i], machines[first]);
+            seed_random(machines[i], batch->jobs[jobs[i]].seed);
+        }
+
+        run_lane_group(worker, machines + first, jobs + first, last - first);
+    }
+
+    return true;
+}
+
+static void *worker_main(void *arg) {
+    struct Worker *worker = (struct Worker *)arg;
+    struct Batch *batch = worker->batch;
+    int job;
+
+    if (batch->engine == ENGINE_LANES) {
+        struct Chip8 *machines[LANE_BATCH] = { NULL };
+
+        while (run_lane_jobs(worker, machines));
+
+        for (int i = 0; i < LANE_BATCH && machines[i] != NULL; i++) destroy_machine(machines[i]);
+        return NULL;
+    }
+
+    struct Chip8 *machine = create_machine();
+    struct Chip8 *shadow = batch->engine == ENGINE_LOCKSTEP ? create_machine() : NULL;
+    bool uses_jit = batch->engine == ENGINE_JIT || batch->engine == ENGINE_LOCKSTEP;
+    struct Jit *jit = uses_jit ? create_jit() : NULL;
+
+    while (next_job(worker, &job)) {
+        run_job(batch, machine, jit, shadow, &batch->jobs[job]);
+    }
+
+    if (jit != NULL) destroy_jit(jit);
+    if (shadow != NULL) destroy_machine(shadow);
+    destroy_machine(machine);
+    return NULL;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: chip8-batch [options] ROM...\n"
+            "  -t THREADS  worker threads (default: online CPUs)\n"
+            "  -c CYCLES   instructions to run per machine\n"
+            "  -f FRAMES   frames to run per machine (alternative to -c)\n"
+            "  -i CYCLES   instructions per frame (default %d)\n"
+            "  -n SEEDS    machines per ROM, each with its own RNG seed (default 1)\n"
+            "  -s SEED     first RNG seed (default 1)\n"
+            "  -e ENGINE   interp, jit, lockstep (JIT diffed against interp) or lanes\n"
+            "              (machines stepped together with SIMD; default interp)\n"
+            "  -a LIBRARY  run a chip8-aot translation (shared object) instead\n",
+            DEFAULT_CYCLES_PER_FRAME);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+    uint64_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    int seeds = 1;
+    unsigned int first_seed = 1;
+    enum Engine engine = ENGINE_INTERPRETER;
+    const char *library = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:c:f:i:n:s:e:a:")) != -1) {
+        switch (opt) {
+            case 't': threads = atol(optarg); break;
+            case 'c': cycles = strtoull(optarg, NULL, 0); break;
+            case 'f': frames = strtoull(optarg, NULL, 0); break;
+            case 'i': cycles_per_frame = strtoull(optarg, NULL, 0); break;
+            case 'n': seeds = atoi(optarg); break;
+            case 's': first_seed = strtoul(optarg, NULL, 0); break;
+            case 'e':
+                if (strcmp(optarg, "interp") == 0) engine = ENGINE_INTERPRETER;
+                else if (strcmp(optarg, "jit") == 0) engine = ENGINE_JIT;
+                else if (strcmp(optarg, "lockstep") == 0) engine = ENGINE_LOCKSTEP;
+                else if (strcmp(optarg, "lanes") == 0) engine = ENGINE_LANES;
+                else usage();
+                break;
+            case 'a': library = optarg; engine = ENGINE_COMPILED; break;
+            default: usage();
+        }
+    }
+
+    if (optind >= argc || threads < 1 || seeds < 1 || cycles_per_frame < 1) usage();
+    if (cycles == 0 && frames == 0) error("No cycle (-c) or frame (-f) budget given", true);
+
+    if ((engine == ENGINE_JIT || engine == ENGINE_LOCKSTEP) && !jit_supported()) {
+        error("JIT not supported on this host, using interpreter", false);
+        engine = ENGINE_INTERPRETER;
+    }
+
+    struct Batch batch;
+    batch.cycle_budget = cycles ? cycles : frames * cycles_per_frame;
+    batch.cycles_per_frame = cycles_per_frame;
+    batch.engine = engine;
+    batch.run_compiled = NULL;
+
+    if (engine == ENGINE_COMPILED) {
+        void *handle = dlopen(library, RTLD_NOW | RTLD_LOCAL);
+
+        if (handle == NULL) {
+            fprintf(stderr, "%s\n", dlerror());
+            error("Failed to load compiled ROM", true);
+        }
+
+        batch.run_compiled = (RunCompiled)dlsym(handle, "run_compiled");
+        if (batch.run_compiled == NULL) error("Compiled ROM has no run_compiled()", true);
+    }
+
+    // Read every ROM once; machines copy from the shared buffers
+    int rom_count = argc - optind;
+    struct Rom *roms = (struct Rom *)calloc(rom_count, sizeof(struct Rom));
+
+    for (int i = 0; i < rom_count; i++) {
+        roms[i].filename = argv[optind + i];
+        roms[i].data = read_rom(roms[i].filename, &roms[i].size);
+    }
+
+    // Jobs are indexed by int in the deques
+    size_t job_count = (size_t)rom_count * (size_t)seeds;
+
+    if (job_count > INT_MAX) error("Too many machines (ROMs x seeds)", true);
+
+    batch.job_count = (int)job_count;
+    batch.jobs = (struct Job *)calloc(job_count, sizeof(struct Job));
+
+    if (batch.jobs == NULL) error("Failed to allocate jobs", true);
+
+    for (int i = 0; i < batch.job_count; i++) {
+        batch.jobs[i].rom = &roms[i / seeds];
+        batch.jobs[i].seed = first_seed + i % seeds;
+    }
+
+    // Deal jobs round-robin; stealing evens out whatever imbalance remains
+    batch.worker_count = threads;
+    batch.workers = (struct Worker *)calloc(batch.worker_count, sizeof(struct Worker));
+
+    // A lanes worker takes no more than its share at once, or the first to start
+    // would steal every job of a batch up to LANE_BATCH and run it on one core
+    int share = batch.job_count / batch.worker_count + (batch.job_count % batch.worker_count != 0);
+
+    if (share > LANE_BATCH) share = LANE_BATCH;
+    batch.lane_chunk = (share + LANE_GROUP - 1) / LANE_GROUP * LANE_GROUP;
+
+    for (int w = 0; w < batch.worker_count; w++) {
+        struct Worker *worker = &batch.workers[w];
+
+        worker->id = w;
+        worker->victim_seed = w + 1;
+        worker->batch = &batch;
+
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->deque.jobs = (int *)malloc(sizeof(int) * (batch.job_count / batch.worker_count + 1));
+        worker->deque.head = 0;
+        worker->deque.tail = 0;
+
+        for (int j = w; j < batch.job_count; j += batch.worker_count) {
+            worker->deque.jobs[worker->deque.tail++] = j;
+        }
+    }
+
+    double start = now_seconds();
+
+    for (int w = 0; w < batch.worker_count; w++) {
+        if (pthread_create(&batch.workers[w].thread, NULL, worker_main, &batch.workers[w]) != 0) {
+            error("Failed to start worker thread", true);
+        }
+    }
+
+    for (int w = 0; w < batch.worker_count; w++) pthread_join(batch.workers[w].thread, NULL);
+
+    double wall = now_seconds() - start;
+    uint64_t total_cycles = 0;
+    uint64_t idle_skips = 0;
+    uint64_t idle_cycles = 0;
+
+    for (int i = 0; i < batch.job_count; i++) {
+        struct Job *job = &batch.jobs[i];
+
+        printf("%s seed=%u cycles=%llu ", job->rom->filename, job->seed, (unsigned long long)job->cycles);
+
+        // Lanes run machines together, so their throughput is reported per group below
+        if (engine != ENGINE_LANES) printf("ips=%.0f ", job->seconds > 0 ? job->cycles / job->seconds : 0.0);
+
+        printf("hash=%016llx pc=%03X I=%03X sp=%u V=", (unsigned long long)job->display_hash, job->pc, job->index, job->sp);
+
+        for (int r = 0; r < 16; r++) printf("%02X ", job->registers[r]);
+
+        if (engine == ENGINE_LOCKSTEP) printf("mismatches=%llu", (unsigned long long)job->mismatches);
+        printf("\n");
+
+        total_cycles += job->cycles;
+        idle_skips += job->idle_skips;
+        idle_cycles += job->idle_cycles;
+    }
+
+    printf("total: machines=%d threads=%d cycles=%llu wall=%.3fs ips=%.0f\n",
+           batch.job_count, batch.worker_count, (unsigned long long)total_cycles,
+           wall, wall > 0 ? total_cycles / wall : 0.0);
+
+    // Each engine skips idle loops at its own granularity, so these differ between engines
+    printf("idle: skips=%llu cycles=%llu\n", (unsigned long long)idle_skips, (unsigned long long)idle_cycles);
+
+    if (engine == ENGINE_LANES) {
+        uint64_t steps = 0;
+        uint64_t diverged = 0;
+        uint64_t vector = 0;
+        uint64_t scalar = 0;
+
+        for (int w = 0; w < batch.worker_count; w++) {
+            steps += batch.workers[w].lane_steps;
+            diverged += batch.workers[w].lane_diverged_steps;
+            vector += batch.workers[w].lane_vector_instructions;
+            scalar += batch.workers[w].lane_scalar_instructions;
+
+            for (int g = 0; g < batch.workers[w].lane_run_count; g++) {
+                const struct LaneRun *run = &batch.workers[w].lane_runs[g];
+
+                printf("lane group: worker=%d machines=%d cycles=%llu wall=%.3fs ips=%.0f\n", w, run->machines,
+                       (unsigned long long)run->cycles, run->seconds, run->seconds > 0 ? run->cycles / run->seconds : 0.0);
+            }
+        }
+
+        printf("lanes: kernel=%s steps=%llu divergence=%.3f vector=%.1f%% lanes/step=%.1f\n",
+               batch.workers[0].lane_target ? batch.workers[0].lane_target : "none", (unsigned long long)steps,
+               steps ? (double)diverged / steps : 0.0,
+               vector + scalar ? 100.0 * vector / (vector + scalar) : 0.0,
+               steps ? (double)(vector + scalar) / steps : 0.0);
+    }
+
+    for (int w = 0; w < batch.worker_count; w++) {
+        pthread_mutex_destroy(&batch.workers[w].deque.lock);
+        free(batch.workers[w].deque.jobs);
+        free(batch.workers[w].lane_runs);
+    }
+
+    for (int i = 0; i < rom_count; i++) free(roms[i].data);
+
+    free(batch.workers);
+    free(batch.jobs);
+    free(roms);
+
+    return 0;
+}
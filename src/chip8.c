@@ -1,5 +1,9 @@
 #include "chip8.h"
 
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
 const uint8_t fontset[FONTSET_SIZE] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
 	0x20, 0x60, 0x20, 0x20, 0x70, // 1
@@ -24,37 +28,182 @@ void error(const char *message, bool fatal) {
     if (fatal) exit(1);
 }
 
-int random() {
-    int byte = rand() % 255;
-    return byte;
+// PCG32 (XSH RR), returning the top byte so all 256 values come out evenly
+uint8_t random_byte(struct Chip8 *state) {
+    uint64_t old = state->rng_state;
+    state->rng_state = old * 6364136223846793005ULL + 1442695040888963407ULL;
+
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+    uint32_t output = (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+
+    return output >> 24;
+}
+
+struct Chip8 *create_machine() {
+    struct Chip8 *state = (struct Chip8 *)malloc(sizeof(struct Chip8));
+
+    if (state == NULL) error("Failed to allocate machine", true);
+
+    state->shared = NULL;
+    initialise(state);
+    return state;
+}
+
+static void attach_shared(struct Chip8 *state, struct SharedMemory *shared) {
+    state->shared = shared;
+    state->memory = shared->memory;
+    state->icache = shared->icache;
 }
 
-void initialise() {
-    for (int i = 0; i < 16; i++) state.registers[i] = 0;
-    for (int i = 0; i < 16; i++) state.stack[i] = 0;
-    for (int i = 0; i < MEMORY_SIZE; i++) state.memory[i] = 0;
+static struct SharedMemory *allocate_shared() {
+    struct SharedMemory *shared = (struct SharedMemory *)malloc(sizeof(struct SharedMemory));
+
+    if (shared == NULL) error("Failed to allocate machine memory", true);
+
+    shared->refs = 1;
+    return shared;
+}
+
+static void release_shared(struct SharedMemory *shared) {
+    if (shared != NULL && __atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL) == 0) free(shared);
+}
+
+void destroy_machine(struct Chip8 *state) {
+    release_machine(state);
+    free(state);
+}
+
+void release_machine(struct Chip8 *state) {
+    release_shared(state->shared);
+    state->shared = NULL;
+    state->memory = NULL;
+    state->icache = NULL;
+}
+
+void copy_machine(struct Chip8 *dst, const struct Chip8 *src) {
+    if (dst == src) return;
+
+    struct SharedMemory *old = dst->shared;
+
+    __atomic_add_fetch(&src->shared->refs, 1, __ATOMIC_RELAXED);
+    *dst = *src; // Everything but memory is small enough to copy outright
+    release_shared(old);
+
+    dst->event_handler = NULL;
+    dst->event_context = NULL;
+}
+
+struct Chip8 *fork_machine(const struct Chip8 *parent) {
+    struct Chip8 *child = (struct Chip8 *)malloc(sizeof(struct Chip8));
+
+    if (child == NULL) error("Failed to allocate machine", true);
+
+    child->shared = NULL;
+    copy_machine(child, parent);
+    return child;
+}
+
+void unshare_memory(struct Chip8 *state) {
+    if (__atomic_load_n(&state->shared->refs, __ATOMIC_ACQUIRE) == 1) return;
+
+    struct SharedMemory *shared = allocate_shared();
+
+    // Keep the decodes too: they are still valid for the copied bytes. Sharers
+    // may be filling them in as we copy, so each entry is read atomically.
+    memcpy(shared->memory, state->memory, sizeof(shared->memory));
+
+    for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+        shared->icache[addr] = __atomic_load_n(&state->icache[addr], __ATOMIC_RELAXED);
+    }
+
+    release_shared(state->shared);
+    attach_shared(state, shared);
+}
+
+void fork_and_step(const struct Chip8 *parent, struct Chip8 **children, int count, const uint16_t *keys, uint64_t cycles) {
+    for (int i = 0; i < count; i++) {
+        if (children[i] == NULL) {
+            children[i] = fork_machine(parent);
+        } else {
+            copy_machine(children[i], parent);
+        }
+
+        if (keys != NULL) set_keypad_mask(children[i], keys[i]);
+
+        run_cycles(children[i], cycles);
+    }
+}
+
+void seed_random(struct Chip8 *state, uint64_t seed) {
+    state->rng_state = seed + 1442695040888963407ULL;
+    random_byte(state); // Mix, so nearby seeds start far apart
+}
+
+uint16_t keypad_mask(const struct Chip8 *state) {
+    return state->keypad;
+}
+
+void set_keypad_mask(struct Chip8 *state, uint16_t mask) {
+    state->keypad = mask;
+}
+
+void set_key(struct Chip8 *state, uint8_t key, bool pressed) {
+    uint16_t bit = 1 << (key & 0xF);
+
+    state->keypad = pressed ? state->keypad | bit : state->keypad & ~bit;
+}
+
+void initialise(struct Chip8 *state) {
+    build_decode_table();
+
+    // Forks may still be reading the old memory; start over on a private copy
+    if (state->shared == NULL || __atomic_load_n(&state->shared->refs, __ATOMIC_ACQUIRE) != 1) {
+        release_shared(state->shared);
+        attach_shared(state, allocate_shared());
+    }
+
+    for (int i = 0; i < 16; i++) state->registers[i] = 0;
+    for (int i = 0; i < 16; i++) state->stack[i] = 0;
+    for (int i = 0; i < MEMORY_SIZE; i++) state->memory[i] = 0;
+    memset(state->icache, 0, MEMORY_SIZE * sizeof(state->icache[0]));
+    state->code_written = true; // Whole address space replaced
 
-    state.index = 0;
-    state.pc = ROM_START_ADDR;
-    state.sp = 0;
-    state.opcode = 0;
+    state->index = 0;
+    state->pc = ROM_START_ADDR;
+    state->sp = 0;
+    state->opcode = 0;
 
-    state.delay_timer = 0;
-    state.sound_timer = 0;
+    state->cycles = 0;
+    state->cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    state->delay_expiry = 0;
+    state->sound_expiry = 0;
 
-    for (int i = 0; i < 16; i++) state.keypad[i] = 0;
-    for (int i = 0; i < SCREEN_SIZE; i++) state.display[i] = 0;
+    state->event_count = 0;
+    state->run_stop = 0;
+    state->event_handler = NULL;
+    state->event_context = NULL;
 
-    // Init RNG
-    srand(time(NULL));
+    state->idle_skips = 0;
+    state->idle_cycles = 0;
+
+    state->faults = 0;
+    memset(state->fault_pc, 0, sizeof(state->fault_pc));
+
+    state->keypad = 0;
+    memset(state->display, 0, sizeof(state->display));
+    state->display_generation = 0;
+
+    // Init RNG (mix in the machine address so machines created together still differ)
+    seed_random(state, (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)state);
 
     // Load fontset
     for (int i = 0; i < FONTSET_SIZE; i++) {
-        state.memory[FONTSET_START_ADDR + i] = fontset[i];
+        state->memory[FONTSET_START_ADDR + i] = fontset[i];
     }
 }
 
-void load_rom(const char *filename) {
+uint8_t *read_rom(const char *filename, size_t *size) {
     FILE *fp;
     size_t fs;
 
@@ -64,520 +213,819 @@ void load_rom(const char *filename) {
     fs = ftell(fp);
     fseek(fp, 0L, SEEK_SET);
 
+    if (fs > MEMORY_SIZE - ROM_START_ADDR) error("ROM file too large", true);
+
     uint8_t *buffer = (uint8_t *)malloc(fs);
 
     if (fread(buffer, 1, fs, fp) < fs && !feof(fp)) error("Failed to read ROM file", true);
 
-    for (long i = 0; i < fs; i++) {
-        state.memory[ROM_START_ADDR + i] = buffer[i];
+    fclose(fp);
+
+    *size = fs;
+    return buffer;
+}
+
+void load_rom_data(struct Chip8 *state, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        write_memory(state, ROM_START_ADDR + i, data[i]);
     }
+}
+
+void write_memory(struct Chip8 *state, uint16_t addr, uint8_t value) {
+    addr &= MEMORY_SIZE - 1;
+
+    // Acquire pairs with a last sibling's release, so its reads are done before we write
+    if (__atomic_load_n(&state->shared->refs, __ATOMIC_ACQUIRE) != 1) unshare_memory(state);
+
+    state->memory[addr] = value;
+
+    // The instructions starting at addr and addr - 1 both contain this byte
+    uint16_t prev = (addr - 1) & (MEMORY_SIZE - 1);
+
+    if (state->icache[addr] != NULL || state->icache[prev] != NULL) state->code_written = true;
+
+    state->icache[addr] = NULL;
+    state->icache[prev] = NULL;
+}
+
+void expand_display(const struct Chip8 *state, uint32_t *pixels) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        uint64_t line = state->display[y];
+
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            pixels[y * SCREEN_WIDTH + x] = (line >> (SCREEN_WIDTH - 1 - x)) & 1 ? 0xFFFFFFFF : 0;
+        }
+    }
+}
+
+const struct Instruction *decode_at(struct Chip8 *state, uint16_t addr) {
+    addr &= MEMORY_SIZE - 1;
+
+    // Relaxed atomics: sharers may fill the same entry at once, always with the same pointer
+    const struct Instruction *ins = __atomic_load_n(&state->icache[addr], __ATOMIC_RELAXED);
+
+    if (ins == NULL) {
+        uint16_t opcode = (state->memory[addr] << 8) | state->memory[(addr + 1) & (MEMORY_SIZE - 1)];
+        ins = &decode_table[opcode];
+        __atomic_store_n(&state->icache[addr], ins, __ATOMIC_RELAXED);
+    }
+
+    return ins;
+}
+
+void load_rom(struct Chip8 *state, const char *filename) {
+    size_t size;
+    uint8_t *buffer = read_rom(filename, &size);
+
+    load_rom_data(state, buffer, size);
 
     free(buffer);
-    fclose(fp);
 }
 
-void cycle() {
-    // Fetch
-    state.opcode = (state.memory[state.pc] << 8) | state.memory[state.pc + 1];
+struct Instruction decode_table[0x10000];
 
-    // Increment PC
-    state.pc += 2;
+static pthread_once_t decode_table_once = PTHREAD_ONCE_INIT;
 
-    // Decode
-    void (*instruction)(void);
+struct Instruction decode_opcode(uint16_t opcode) {
+    struct Instruction ins;
 
-    switch ((state.opcode & 0xF000) >> 12) {
+    // Operands
+    ins.x = (opcode & 0x0F00) >> 8;
+    ins.y = (opcode & 0x00F0) >> 4;
+    ins.kk = opcode & 0x00FF;
+    ins.n = opcode & 0x000F;
+    ins.nnn = opcode & 0x0FFF;
+
+    // Handler
+    switch ((opcode & 0xF000) >> 12) {
         case 0x0:
-            switch (state.opcode & 0xF) {
-                case 0x0:
-                    instruction = &OP_00E0;
+            switch (opcode & 0xFFF) {
+                case 0x0E0:
+                    ins.execute = &OP_00E0;
                     break;
 
-                case 0xE:
-                    instruction = &OP_00EE;
+                case 0x0EE:
+                    ins.execute = &OP_00EE;
                     break;
 
                 default:
-                    instruction = &OP_NULL;
+                    ins.execute = &OP_NULL;
             }
+            break;
 
         case 0x1:
-            instruction = &OP_1NNN;
+            ins.execute = &OP_1NNN;
             break;
 
         case 0x2:
-            instruction = &OP_2NNN;
+            ins.execute = &OP_2NNN;
             break;
 
         case 0x3:
-            instruction = &OP_3XKK;
+            ins.execute = &OP_3XKK;
             break;
 
         case 0x4:
-            instruction = &OP_4XKK;
+            ins.execute = &OP_4XKK;
             break;
 
         case 0x5:
-            instruction = &OP_5XY0;
+            ins.execute = &OP_5XY0;
             break;
 
         case 0x6: 
-            instruction = &OP_6XKK;
+            ins.execute = &OP_6XKK;
             break;
 
         case 0x7:
-            instruction = &OP_7XKK;
+            ins.execute = &OP_7XKK;
             break;
 
         case 0x8:
-            switch (state.opcode & 0xF) {
+            switch (opcode & 0xF) {
                 case 0x0:
-                    instruction = &OP_8XY0;
+                    ins.execute = &OP_8XY0;
                     break;
 
                 case 0x1:
-                    instruction = &OP_8XY1;
+                    ins.execute = &OP_8XY1;
                     break;
 
                 case 0x2:
-                    instruction = &OP_8XY2;
+                    ins.execute = &OP_8XY2;
                     break;
 
                 case 0x3:
-                    instruction = &OP_8XY3;
+                    ins.execute = &OP_8XY3;
                     break;
 
                 case 0x4:
-                    instruction = &OP_8XY4;
+                    ins.execute = &OP_8XY4;
                     break;
 
                 case 0x5:
-                    instruction = &OP_8XY5;
+                    ins.execute = &OP_8XY5;
                     break;
 
                 case 0x6:
-                    instruction = &OP_8XY6;
+                    ins.execute = &OP_8XY6;
                     break;
 
                 case 0x7:
-                    instruction = &OP_8XY7;
+                    ins.execute = &OP_8XY7;
                     break;
 
                 case 0xE:
-                    instruction = &OP_8XYE;
+                    ins.execute = &OP_8XYE;
                     break;
 
                 default:
-                    instruction = &OP_NULL;
+                    ins.execute = &OP_NULL;
             }
+            break;
 
         case 0x9:
-            instruction = &OP_9XY0;
+            ins.execute = &OP_9XY0;
             break;
 
         case 0xA:
-            instruction = &OP_ANNN;
+            ins.execute = &OP_ANNN;
             break;
 
         case 0xB:
-            instruction = &OP_BNNN;
+            ins.execute = &OP_BNNN;
             break;
 
         case 0xC:
-            instruction = &OP_CXKK;
+            ins.execute = &OP_CXKK;
             break;
 
         case 0xD:
-            instruction = &OP_DXYN;
+            ins.execute = &OP_DXYN;
             break;
 
         case 0xE:
-            switch (state.opcode & 0xFF) {
+            switch (opcode & 0xFF) {
                 case 0x9E:
-                    instruction = &OP_EX9E;
+                    ins.execute = &OP_EX9E;
                     break;
 
                 case 0xA1:
-                    instruction = &OP_EXA1;
+                    ins.execute = &OP_EXA1;
                     break;
 
                 default:
-                    instruction = &OP_NULL;
+                    ins.execute = &OP_NULL;
             }
+            break;
 
         case 0xF:
-            switch (state.opcode & 0xFF) {
+            switch (opcode & 0xFF) {
                 case 0x07:
-                    instruction = &OP_FX07;
+                    ins.execute = &OP_FX07;
                     break;
 
                 case 0x0A:
-                    instruction = &OP_FX0A;
+                    ins.execute = &OP_FX0A;
                     break;
 
                 case 0x15:
-                    instruction = &OP_FX15;
+                    ins.execute = &OP_FX15;
                     break;
 
                 case 0x18:
-                    instruction = &OP_FX18;
+                    ins.execute = &OP_FX18;
                     break;
 
                 case 0x1E:
-                    instruction = &OP_FX1E;
+                    ins.execute = &OP_FX1E;
                     break;
 
                 case 0x29:
-                    instruction = &OP_FX29;
+                    ins.execute = &OP_FX29;
                     break;
 
                 case 0x33:
-                    instruction = &OP_FX33;
+                    ins.execute = &OP_FX33;
                     break;
 
                 case 0x55:
-                    instruction = &OP_FX55;
+                    ins.execute = &OP_FX55;
                     break;
 
                 case 0x65:
-                    instruction = &OP_FX65;
+                    ins.execute = &OP_FX65;
                     break;
 
                 default:
-                    instruction = &OP_NULL;
+                    ins.execute = &OP_NULL;
             }
+            break;
 
         default:
-            instruction = &OP_NULL;
+            ins.execute = &OP_NULL;
+            break;
+    }
+
+    return ins;
+}
+
+static void fill_decode_table() {
+    for (uint32_t opcode = 0; opcode <= 0xFFFF; opcode++) {
+        decode_table[opcode] = decode_opcode(opcode);
     }
+}
+
+void build_decode_table() {
+    pthread_once(&decode_table_once, fill_decode_table);
+}
+
+const char *handler_name(Handler h) {
+    static const struct { Handler handler; const char *name; } names[] = {
+        { &OP_NULL, "OP_NULL" }, { &OP_00E0, "OP_00E0" }, { &OP_00EE, "OP_00EE" },
+        { &OP_1NNN, "OP_1NNN" }, { &OP_2NNN, "OP_2NNN" }, { &OP_3XKK, "OP_3XKK" },
+        { &OP_4XKK, "OP_4XKK" }, { &OP_5XY0, "OP_5XY0" }, { &OP_6XKK, "OP_6XKK" },
+        { &OP_7XKK, "OP_7XKK" }, { &OP_8XY0, "OP_8XY0" }, { &OP_8XY1, "OP_8XY1" },
+        { &OP_8XY2, "OP_8XY2" }, { &OP_8XY3, "OP_8XY3" }, { &OP_8XY4, "OP_8XY4" },
+        { &OP_8XY5, "OP_8XY5" }, { &OP_8XY6, "OP_8XY6" }, { &OP_8XY7, "OP_8XY7" },
+        { &OP_8XYE, "OP_8XYE" }, { &OP_9XY0, "OP_9XY0" }, { &OP_ANNN, "OP_ANNN" },
+        { &OP_BNNN, "OP_BNNN" }, { &OP_CXKK, "OP_CXKK" }, { &OP_DXYN, "OP_DXYN" },
+        { &OP_EX9E, "OP_EX9E" }, { &OP_EXA1, "OP_EXA1" }, { &OP_FX07, "OP_FX07" },
+        { &OP_FX0A, "OP_FX0A" }, { &OP_FX15, "OP_FX15" }, { &OP_FX18, "OP_FX18" },
+        { &OP_FX1E, "OP_FX1E" }, { &OP_FX29, "OP_FX29" }, { &OP_FX33, "OP_FX33" },
+        { &OP_FX55, "OP_FX55" }, { &OP_FX65, "OP_FX65" },
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (names[i].handler == h) return names[i].name;
+    }
+
+    return "OP_NULL";
+}
+
+void cycle(struct Chip8 *state) {
+    uint16_t addr = state->pc & (MEMORY_SIZE - 1);
+    const struct Instruction *ins = __atomic_load_n(&state->icache[addr], __ATOMIC_RELAXED);
+
+    // Fetch and decode only the first time an address runs (or after it is written)
+    if (ins == NULL) ins = decode_at(state, addr);
+
+    state->opcode = ins - decode_table;
+
+    // Increment PC
+    state->pc += 2;
 
     // Execute
-    instruction();
+    ins->execute(state, ins);
+
+    state->cycles++;
+}
+
+// 
+// Timers and events
+// 
+
+uint64_t current_tick(const struct Chip8 *state) {
+    return state->cycles / state->cycles_per_frame;
+}
+
+static uint8_t timer_value(const struct Chip8 *state, uint64_t expiry) {
+    uint64_t tick = current_tick(state);
+
+    return expiry > tick ? (uint8_t)(expiry - tick) : 0;
+}
+
+uint8_t delay_timer(const struct Chip8 *state) {
+    return timer_value(state, state->delay_expiry);
+}
+
+uint8_t sound_timer(const struct Chip8 *state) {
+    return timer_value(state, state->sound_expiry);
+}
+
+bool sound_active(const struct Chip8 *state) {
+    return state->sound_expiry > current_tick(state);
+}
+
+void set_delay_timer(struct Chip8 *state, uint8_t value) {
+    state->delay_expiry = current_tick(state) + value;
+
+    if (value > 0) {
+        schedule_event(state, state->delay_expiry * state->cycles_per_frame, EVENT_DELAY_EXPIRED);
+    } else {
+        cancel_event(state, EVENT_DELAY_EXPIRED);
+    }
+}
+
+void set_sound_timer(struct Chip8 *state, uint8_t value) {
+    bool was_active = sound_active(state);
+
+    state->sound_expiry = current_tick(state) + value;
+
+    // Edges are due at the end of this instruction, so listeners see exact cycles
+    if (value > 0) {
+        if (!was_active) schedule_event(state, state->cycles + 1, EVENT_SOUND_ON);
+        schedule_event(state, state->sound_expiry * state->cycles_per_frame, EVENT_SOUND_OFF);
+    } else if (was_active) {
+        schedule_event(state, state->cycles + 1, EVENT_SOUND_OFF);
+    }
+}
+
+void cancel_event(struct Chip8 *state, enum EventType type) {
+    for (int i = 0; i < state->event_count; i++) {
+        if (state->events[i].type == type) {
+            memmove(&state->events[i], &state->events[i + 1], (state->event_count - i - 1) * sizeof(struct Event));
+            state->event_count--;
+            return;
+        }
+    }
+}
+
+void schedule_event(struct Chip8 *state, uint64_t cycle, enum EventType type) {
+    cancel_event(state, type);
+
+    if (state->event_count == MAX_EVENTS) error("Event queue full", true);
+
+    // Insertion sort: the queue holds a handful of entries at most
+    int i = state->event_count;
+    while (i > 0 && state->events[i - 1].cycle > cycle) {
+        state->events[i] = state->events[i - 1];
+        i--;
+    }
+
+    state->events[i].cycle = cycle;
+    state->events[i].type = type;
+    state->event_count++;
+
+    if (cycle < state->run_stop) state->run_stop = cycle;
+}
+
+void dispatch_events(struct Chip8 *state) {
+    while (state->event_count > 0 && state->events[0].cycle <= state->cycles) {
+        struct Event event = state->events[0];
+
+        memmove(&state->events[0], &state->events[1], (state->event_count - 1) * sizeof(struct Event));
+        state->event_count--;
+
+        if (state->event_handler != NULL) state->event_handler(state->event_context, state, &event);
+    }
+}
+
+void update_run_stop(struct Chip8 *state, uint64_t end) {
+    state->run_stop = end;
+
+    if (state->event_count > 0 && state->events[0].cycle < end) state->run_stop = state->events[0].cycle;
+}
+
+void run_cycles(struct Chip8 *state, uint64_t count) {
+    uint64_t end = state->cycles + count;
+
+    while (state->cycles < end) {
+        update_run_stop(state, end);
+
+        // No per-instruction timer or event work: handlers that schedule
+        // something earlier pull run_stop in
+        while (state->cycles < state->run_stop) cycle(state);
+
+        dispatch_events(state);
+    }
+}
 
-    // Decrement timers
-    if (state.delay_timer > 0) state.delay_timer--;
-    if (state.sound_timer > 0) state.sound_timer--;
+void run_frame(struct Chip8 *state) {
+    run_cycles(state, state->cycles_per_frame);
+}
+
+// 
+// Idle detection
+// 
+
+// Whole iterations of a `period`-instruction loop that fit before run_stop.
+// Called from the loop's last instruction, which cycle() has yet to count.
+static uint64_t idle_iterations(const struct Chip8 *state, uint64_t period) {
+    uint64_t next = state->cycles + 1;
+
+    return state->run_stop > next ? (state->run_stop - next) / period : 0;
+}
+
+static void skip_idle(struct Chip8 *state, uint64_t cycles) {
+    if (cycles == 0) return;
+
+    state->cycles += cycles;
+    state->idle_skips++;
+    state->idle_cycles += cycles;
+}
+
+// FX07 VX; 3X00; 1NNN back to the FX07: spin until the delay timer reads 0
+static bool is_delay_wait(const struct Chip8 *state, uint16_t start) {
+    const uint8_t *m = state->memory;
+    uint16_t a = start & (MEMORY_SIZE - 1);
+
+    if (a > MEMORY_SIZE - 4) return false;
+
+    return (m[a] & 0xF0) == 0xF0 && m[a + 1] == 0x07 && m[a + 2] == (0x30 | (m[a] & 0x0F)) && m[a + 3] == 0x00;
+}
+
+static void skip_delay_wait(struct Chip8 *state, uint16_t start) {
+    uint8_t vx = state->memory[start] & 0x0F;
+    uint64_t next = state->cycles + 1; // The loop's FX07 runs again here
+    uint64_t expires = state->delay_expiry * state->cycles_per_frame;
+    uint64_t iterations = idle_iterations(state, 3);
+
+    // Stop on an iteration boundary no later than the one that reads 0
+    if (next >= expires) return;
+    if (iterations > (expires - next + 2) / 3) iterations = (expires - next + 2) / 3;
+    if (iterations == 0) return;
+
+    // Leave VX as the last skipped FX07 would have
+    uint64_t last_read = state->cycles + 3 * iterations - 2;
+    uint64_t tick = last_read / state->cycles_per_frame;
+    state->registers[vx] = state->delay_expiry > tick ? (uint8_t)(state->delay_expiry - tick) : 0;
+
+    skip_idle(state, 3 * iterations);
+}
+
+bool may_idle(const struct Instruction *ins, uint16_t addr) {
+    return ins->execute == &OP_1NNN && (ins->nnn == addr || ins->nnn == addr - 4);
+}
+
+bool reads_cycles(const struct Instruction *ins, uint16_t addr) {
+    Handler h = ins->execute;
+
+    return h == &OP_FX07 || h == &OP_FX0A || h == &OP_FX15 || h == &OP_FX18 || may_idle(ins, addr);
 }
 
 // 
 // Instructions
 // 
 
-void OP_NULL() {
-    return;
+const char *fault_name(enum Fault fault) {
+    switch (fault) {
+        case FAULT_STACK_OVERFLOW: return "stack overflow";
+        case FAULT_STACK_UNDERFLOW: return "stack underflow";
+        case FAULT_INDEX_OVERRUN: return "index overrun";
+        case FAULT_NULL_OPCODE: return "null opcode";
+    }
+
+    return "unknown fault";
+}
+
+// Called from a handler, after cycle() has advanced PC past the instruction
+static void raise_fault(struct Chip8 *state, enum Fault fault) {
+    if (!(state->faults & fault)) state->fault_pc[__builtin_ctz(fault)] = (state->pc - 2) & (MEMORY_SIZE - 1);
+    state->faults |= fault;
 }
 
-void OP_00E0() {
+void OP_NULL(struct Chip8 *state, const struct Instruction *ins) {
+    raise_fault(state, FAULT_NULL_OPCODE);
+}
+
+void OP_00E0(struct Chip8 *state, const struct Instruction *ins) {
     // Sets all display pixels to 0, thus clearing
-    for (int i = 0; i < SCREEN_SIZE; i++) {
-        state.display[i] = 0;
-    }
+    memset(state->display, 0, sizeof(state->display));
+    state->display_generation++;
 }
 
-void OP_00EE() {
-    state.sp--; // Pops stack
-    state.pc = state.stack[state.sp]; // Sets PC to top of stack
+void OP_00EE(struct Chip8 *state, const struct Instruction *ins) {
+    if (state->sp == 0) raise_fault(state, FAULT_STACK_UNDERFLOW);
+
+    state->sp--; // Pops stack
+    state->pc = state->stack[state->sp & 0xF]; // Sets PC to top of stack (wrapping, so a bad SP can't reach past the stack)
 }
 
-void OP_1NNN() {
-    uint16_t addr = state.opcode & 0x0FFF; // Get dest addr as NNN bits
-    state.pc = addr; // Sets PC to dest addr
+void OP_1NNN(struct Chip8 *state, const struct Instruction *ins) {
+    uint16_t self = state->pc - 2;
+    uint16_t addr = ins->nnn; // Get dest addr as NNN bits
+    state->pc = addr; // Sets PC to dest addr
+
+    // Halt (jump to self), or the jump closing a delay-timer wait; may_idle() covers both
+    if (addr == self) {
+        skip_idle(state, idle_iterations(state, 1));
+    } else if (addr == self - 4 && is_delay_wait(state, addr)) {
+        skip_delay_wait(state, addr);
+    }
 }
 
-void OP_2NNN() {
-    uint16_t addr = state.opcode & 0x0FFF; // Get dest addr as NNN bits
-    state.stack[state.sp] = state.pc; // Save instruction after CALL on top of stack
-    state.sp++; // Pushes stack
-    state.pc = addr; // Set next instruction to dest addr
+void OP_2NNN(struct Chip8 *state, const struct Instruction *ins) {
+    uint16_t addr = ins->nnn; // Get dest addr as NNN bits
+
+    if (state->sp >= 16) raise_fault(state, FAULT_STACK_OVERFLOW);
+
+    state->stack[state->sp & 0xF] = state->pc; // Save instruction after CALL on top of stack (wrapping, as in 00EE)
+    state->sp++; // Pushes stack
+    state->pc = addr; // Set next instruction to dest addr
 }
 
-void OP_3XKK() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register number
-    uint8_t byte = state.opcode & 0x00FF; // Get literal byte
+void OP_3XKK(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register number
+    uint8_t byte = ins->kk; // Get literal byte
 
     // If equal, skip instruction
-    if (state.registers[vx] == byte) {
-        state.pc += 2; 
+    if (state->registers[vx] == byte) {
+        state->pc += 2; 
     }
 }
 
-void OP_4XKK() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register number
-    uint8_t byte = state.opcode & 0x00FF; // Get literal byte
+void OP_4XKK(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register number
+    uint8_t byte = ins->kk; // Get literal byte
 
     // If *not* equal, skip instruction
-    if (state.registers[vx] != byte) {
-        state.pc += 2;
+    if (state->registers[vx] != byte) {
+        state->pc += 2;
     }
 }
 
-void OP_5XY0() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register number X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register number Y
+void OP_5XY0(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register number X
+    uint8_t vy = ins->y; // Get register number Y
 
     // If register X == register Y, skip instruction
-    if (state.registers[vx] == state.registers[vy]) {
-        state.pc += 2;
+    if (state->registers[vx] == state->registers[vy]) {
+        state->pc += 2;
     }
 }
 
-void OP_6XKK() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register number
-    uint8_t byte = state.opcode & 0x00FF; // Get literal byte
+void OP_6XKK(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register number
+    uint8_t byte = ins->kk; // Get literal byte
 
     // Load byte into register
-    state.registers[vx] = byte;
+    state->registers[vx] = byte;
 }
 
-void OP_7XKK() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register number
-    uint8_t byte = state.opcode & 0x00FF; // Get literal byte
+void OP_7XKK(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register number
+    uint8_t byte = ins->kk; // Get literal byte
 
     // ADD byte into register
-    state.registers[vx] += byte;
+    state->registers[vx] += byte;
 }
 
-void OP_8XY0() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register Y
+void OP_8XY0(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
+    uint8_t vy = ins->y; // Get register Y
 
     // Load register Y into register X
-    state.registers[vx] = state.registers[vy];
+    state->registers[vx] = state->registers[vy];
 }
 
-void OP_8XY1() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register Y
+void OP_8XY1(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
+    uint8_t vy = ins->y; // Get register Y
 
     // OR byte into register
-    state.registers[vx] |= state.registers[vy];
+    state->registers[vx] |= state->registers[vy];
 }
 
-void OP_8XY2() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register Y
+void OP_8XY2(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
+    uint8_t vy = ins->y; // Get register Y
 
     // AND byte into register
-    state.registers[vx] &= state.registers[vy];
+    state->registers[vx] &= state->registers[vy];
 }
 
-void OP_8XY3() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register Y
+void OP_8XY3(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
+    uint8_t vy = ins->y; // Get register Y
 
     // XOR byte into register
-    state.registers[vx] ^= state.registers[vy];
+    state->registers[vx] ^= state->registers[vy];
 }
 
-void OP_8XY4() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register Y
+void OP_8XY4(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
+    uint8_t vy = ins->y; // Get register Y
 
     // Calculate whole sum
-    uint16_t sum = state.registers[vx] + state.registers[vy];
+    uint16_t sum = state->registers[vx] + state->registers[vy];
 
     // If whole sum greater than 255 (1 byte), set carry bit in flag register
-    if (sum > 255) state.registers[FLAG_REGISTER] = 1;
-    else           state.registers[FLAG_REGISTER] = 0;
+    if (sum > 255) state->registers[FLAG_REGISTER] = 1;
+    else           state->registers[FLAG_REGISTER] = 0;
 
     // Save least significant byte to VX
-    state.registers[vx] = sum & 0xFF;
+    state->registers[vx] = sum & 0xFF;
 }
 
-void OP_8XY5() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register Y
+void OP_8XY5(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
+    uint8_t vy = ins->y; // Get register Y
 
-    if (state.registers[vx] > state.registers[vy]) state.registers[FLAG_REGISTER] = 1;
-    else                                           state.registers[FLAG_REGISTER] = 0;
+    if (state->registers[vx] > state->registers[vy]) state->registers[FLAG_REGISTER] = 1;
+    else                                           state->registers[FLAG_REGISTER] = 0;
 
-    state.registers[vx] = state.registers[vx] - state.registers[vy];
+    state->registers[vx] = state->registers[vx] - state->registers[vy];
 }
 
-void OP_8XY6() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
+void OP_8XY6(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
 
-    state.registers[FLAG_REGISTER] = (state.registers[vx] & 0x1);
+    state->registers[FLAG_REGISTER] = (state->registers[vx] & 0x1);
 
-    state.registers[vx] >>= 1;
+    state->registers[vx] >>= 1;
 }
 
-void OP_8XY7() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register Y
+void OP_8XY7(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
+    uint8_t vy = ins->y; // Get register Y
 
-    if (state.registers[vy] > state.registers[vx]) state.registers[FLAG_REGISTER] = 1;
-    else                                           state.registers[FLAG_REGISTER] = 0;
+    if (state->registers[vy] > state->registers[vx]) state->registers[FLAG_REGISTER] = 1;
+    else                                           state->registers[FLAG_REGISTER] = 0;
 
-    state.registers[vx] = state.registers[vy] - state.registers[vx];
+    state->registers[vx] = state->registers[vy] - state->registers[vx];
 }
 
-void OP_8XYE() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
+void OP_8XYE(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
 
     // Save MSB in VF
-    state.registers[FLAG_REGISTER] = (state.registers[vx] & 0x80) >> 7;
+    state->registers[FLAG_REGISTER] = (state->registers[vx] & 0x80) >> 7;
 
-    state.registers[vx] <<= 1;
+    state->registers[vx] <<= 1;
 }
 
-void OP_9XY0() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register X
-    uint8_t vy = (state.opcode & 0x00F0) >> 4; // Get register Y
+void OP_9XY0(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register X
+    uint8_t vy = ins->y; // Get register Y
 
     // Skip to next instruction if not equal
-    if (state.registers[vx] != state.registers[vy]) state.pc += 2;
+    if (state->registers[vx] != state->registers[vy]) state->pc += 2;
 }
 
-void OP_ANNN() {
-    uint16_t addr = state.opcode & 0x0FFF; // Calc dest addr
-    state.index = addr; // Set index to dest addr
+void OP_ANNN(struct Chip8 *state, const struct Instruction *ins) {
+    uint16_t addr = ins->nnn; // Calc dest addr
+    state->index = addr; // Set index to dest addr
 }
 
-void OP_BNNN() {
-    uint16_t addr = state.opcode & 0x0FFF; // Calc dest addr
-    state.pc = addr + state.registers[0]; // Set PC to dest addr + offset
+void OP_BNNN(struct Chip8 *state, const struct Instruction *ins) {
+    uint16_t addr = ins->nnn; // Calc dest addr
+    state->pc = addr + state->registers[0]; // Set PC to dest addr + offset
 }
 
-void OP_CXKK() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8; // Get register number
-    uint8_t byte = state.opcode & 0x00FF; // Get literal byte
+void OP_CXKK(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x; // Get register number
+    uint8_t byte = ins->kk; // Get literal byte
 
-    state.registers[vx] = random() & byte; // Set register random byte AND literal byte
+    state->registers[vx] = random_byte(state) & byte; // Set register random byte AND literal byte
 }
 
-void OP_DXYN() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
-    uint8_t vy = (state.opcode & 0x00F0) >> 4;
+void OP_DXYN(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+    uint8_t vy = ins->y;
+
+    uint8_t height = ins->n;
 
-    uint8_t height = state.opcode & 0x000F;
+    uint8_t x_pos = state->registers[vx] % SCREEN_WIDTH;
+    uint8_t y_pos = state->registers[vy] % SCREEN_HEIGHT;
 
-    uint8_t x_pos = state.registers[vx] % SCREEN_WIDTH;
-    uint8_t y_pos = state.registers[vy] % SCREEN_HEIGHT;
+    state->registers[FLAG_REGISTER] = 0;
 
-    state.registers[FLAG_REGISTER] = 0;
+    if (state->index + height > MEMORY_SIZE) raise_fault(state, FAULT_INDEX_OVERRUN);
 
     for (unsigned int row = 0; row < height; row++) {
-        uint8_t spriteByte = state.memory[state.index + row];
+        uint8_t spriteByte = state->memory[(state->index + row) & (MEMORY_SIZE - 1)];
 
-        for (unsigned int col = 0; col < 8; col++) {
-            uint8_t spritePixel = spriteByte & (0x80 >> col);
-            uint32_t *screenPixel = &state.display[(y_pos + row) * SCREEN_WIDTH + (x_pos + col)];
+        // Line the sprite byte up with x_pos, wrapping past the right edge
+        uint64_t sprite = (uint64_t)spriteByte << 56;
+        sprite = (sprite >> x_pos) | (sprite << ((SCREEN_WIDTH - x_pos) & (SCREEN_WIDTH - 1)));
 
-            if (spritePixel) {
-                if (*screenPixel == 0xFFFFFFFF) state.registers[FLAG_REGISTER] = 1;
-                *screenPixel ^= 0xFFFFFFFF;
-            }
-        }
+        uint64_t *line = &state->display[(y_pos + row) % SCREEN_HEIGHT];
+
+        // Any lit pixel under the sprite is a collision
+        if (*line & sprite) state->registers[FLAG_REGISTER] = 1;
+        *line ^= sprite;
     }
+
+    state->display_generation++;
 }
 
-void OP_EX9E() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
-    uint8_t key = state.registers[vx];
-
-    if (state.keypad[key]) state.pc += 2;
-}
-
-void OP_EXA1() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
-    uint8_t key = state.registers[vx];
-
-    if (!state.keypad[key]) state.pc += 2;
-}
-
-void OP_FX07() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
-
-    state.registers[vx] = state.delay_timer;
-}
-
-void OP_FX0A() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
-
-    if (state.keypad[0x0]) {
-        state.registers[vx] = 0x0;
-    } else if (state.keypad[0x1]) {
-        state.registers[vx] = 0x1;
-    } else if (state.keypad[0x2]) {
-        state.registers[vx] = 0x2;
-    } else if (state.keypad[0x3]) {
-        state.registers[vx] = 0x3;
-    } else if (state.keypad[0x4]) {
-        state.registers[vx] = 0x4;
-    } else if (state.keypad[0x5]) {
-        state.registers[vx] = 0x5;
-    } else if (state.keypad[0x6]) {
-        state.registers[vx] = 0x6;
-    } else if (state.keypad[0x7]) {
-        state.registers[vx] = 0x7;
-    } else if (state.keypad[0x8]) {
-        state.registers[vx] = 0x8;
-    } else if (state.keypad[0x9]) {
-        state.registers[vx] = 0x9;
-    } else if (state.keypad[0xA]) {
-        state.registers[vx] = 0xA;
-    } else if (state.keypad[0xB]) {
-        state.registers[vx] = 0xB;
-    } else if (state.keypad[0xC]) {
-        state.registers[vx] = 0xC;
-    } else if (state.keypad[0xD]) {
-        state.registers[vx] = 0xD;
-    } else if (state.keypad[0xE]) {
-        state.registers[vx] = 0xE;
-    } else if (state.keypad[0xF]) {
-        state.registers[vx] = 0xF;
+void OP_EX9E(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+    uint8_t key = state->registers[vx] & 0xF;
+
+    if ((state->keypad >> key) & 1) state->pc += 2;
+}
+
+void OP_EXA1(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+    uint8_t key = state->registers[vx] & 0xF;
+
+    if (!((state->keypad >> key) & 1)) state->pc += 2;
+}
+
+void OP_FX07(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+
+    state->registers[vx] = delay_timer(state);
+}
+
+void OP_FX0A(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+
+    // Lowest held key wins
+    if (state->keypad != 0) {
+        state->registers[vx] = __builtin_ctz(state->keypad);
     } else {
-        state.pc -= 2;
+        // Keys only change between runs, so nothing can wake this before run_stop
+        state->pc -= 2;
+        skip_idle(state, idle_iterations(state, 1));
     }
 }
 
-void OP_FX15() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
+void OP_FX15(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
 
-    state.delay_timer = state.registers[vx];
+    set_delay_timer(state, state->registers[vx]);
 }
 
-void OP_FX18() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
+void OP_FX18(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
 
-    state.sound_timer = state.registers[vx];
+    set_sound_timer(state, state->registers[vx]);
 }
 
-void OP_FX1E() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
+void OP_FX1E(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
 
-    state.index = state.registers[vx];
+    state->index = state->registers[vx];
 }
 
-void OP_FX29() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
-    uint8_t digit = state.registers[vx];
+void OP_FX29(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+    uint8_t digit = state->registers[vx];
 
-    state.index = FONTSET_START_ADDR + (digit * 5);
+    state->index = FONTSET_START_ADDR + (digit * 5);
 }
 
-void OP_FX33() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
-    uint8_t value = state.registers[vx];
+void OP_FX33(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+    uint8_t value = state->registers[vx];
 
-    state.memory[state.index + 2] = value % 10;
+    if (state->index + 3 > MEMORY_SIZE) raise_fault(state, FAULT_INDEX_OVERRUN);
+
+    write_memory(state, state->index + 2, value % 10);
     value /= 10;
 
-    state.memory[state.index + 1] = value % 10;
+    write_memory(state, state->index + 1, value % 10);
     value /= 10;
 
-    state.memory[state.index] = value % 10;
+    write_memory(state, state->index, value % 10);
 }
 
-void OP_FX55() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
+void OP_FX55(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+
+    if (state->index + vx >= MEMORY_SIZE) raise_fault(state, FAULT_INDEX_OVERRUN);
 
-    for (uint8_t i = 0; i <= vx; i++) state.memory[state.index + i] = state.registers[i];
+    for (uint8_t i = 0; i <= vx; i++) write_memory(state, state->index + i, state->registers[i]);
 }
 
-void OP_FX65() {
-    uint8_t vx = (state.opcode & 0x0F00) >> 8;
+void OP_FX65(struct Chip8 *state, const struct Instruction *ins) {
+    uint8_t vx = ins->x;
+
+    if (state->index + vx >= MEMORY_SIZE) raise_fault(state, FAULT_INDEX_OVERRUN);
 
-    for (uint8_t i = 0; i <= vx; i++) state.registers[i] = state.memory[state.index + i];
+    // Wraps like write_memory(), rather than reading past the end
+    for (uint8_t i = 0; i <= vx; i++) state->registers[i] = state->memory[(state->index + i) & (MEMORY_SIZE - 1)];
 }
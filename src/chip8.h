@@ -17,69 +17,216 @@
 #define FONTSET_START_ADDR 0x50
 #define ROM_START_ADDR 0x200
 
-const uint8_t fontset[FONTSET_SIZE];
+extern const uint8_t fontset[FONTSET_SIZE];
+
+struct Instruction;
+struct Chip8;
+
+// Scheduled core events, kept sorted by cycle in a small fixed queue
+enum EventType {
+    EVENT_DELAY_EXPIRED, // Delay timer reached 0
+    EVENT_SOUND_ON,      // Sound timer set non-zero while silent
+    EVENT_SOUND_OFF,     // Sound timer reached 0 (or was cleared)
+};
+
+#define MAX_EVENTS 8
+
+struct Event {
+    uint64_t cycle; // Instruction count the event is due at
+    enum EventType type;
+};
+
+// Faults: behaviour real interpreters leave undefined. They are recorded, not
+// trapped, and execution carries on as it always has (stack and memory wrap).
+enum Fault {
+    FAULT_STACK_OVERFLOW = 1 << 0,  // 2NNN with all 16 stack entries in use
+    FAULT_STACK_UNDERFLOW = 1 << 1, // 00EE with an empty stack
+    FAULT_INDEX_OVERRUN = 1 << 2,   // FX33/FX55/FX65/DXYN reaching past the end of memory
+    FAULT_NULL_OPCODE = 1 << 3,     // Executed an opcode that is no instruction
+};
+
+#define FAULT_COUNT 4
+
+typedef void (*EventHandler)(void *context, struct Chip8 *state, const struct Event *event);
+
+// Memory and its decode cache, shared copy-on-write between forked machines.
+// The icache is a pure function of memory, so sharers may fill it concurrently
+// (every thread writes the same pointer, with relaxed atomics); any store
+// unshares first.
+struct SharedMemory {
+    uint32_t refs; // Machines pointing here, updated atomically
+    uint8_t memory[MEMORY_SIZE];
+    const struct Instruction *icache[MEMORY_SIZE];
+};
 
 struct Chip8 {
     uint8_t registers[16];
     uint16_t stack[16];
-    uint8_t memory[MEMORY_SIZE];
+    uint8_t *memory; // MEMORY_SIZE bytes in `shared`, read-only while shared
 
     uint16_t index;
     uint16_t pc;
     uint8_t sp;
     uint16_t opcode;
 
-    uint8_t delay_timer;
-    uint8_t sound_timer;
+    // Timers are not decremented; each stores the virtual tick it reaches 0 at,
+    // and its value is derived from the instruction count when read
+    uint64_t cycles;           // Instructions executed since initialise()
+    uint32_t cycles_per_frame; // Instructions per timer tick (configuration, set after initialise())
+    uint64_t delay_expiry;
+    uint64_t sound_expiry;
+
+    struct Event events[MAX_EVENTS];
+    uint8_t event_count;
+    uint64_t run_stop; // run_cycles() stops here to dispatch; schedule_event() may lower it
+    EventHandler event_handler; // Optional, called for each event as it is dispatched
+    void *event_context;
+
+    // Idle loops (jump-to-self, FX0A with no key, delay-timer polling) are
+    // fast-forwarded to run_stop instead of being interpreted
+    uint64_t idle_skips;
+    uint64_t idle_cycles; // Instructions accounted for by skips rather than executed
+
+    uint16_t keypad; // Bit n set while key n is held
+    uint64_t display[SCREEN_HEIGHT]; // 1bpp, one word per row, MSB is x = 0
+    uint32_t display_generation; // Bumped whenever display changes, so frontends skip unchanged frames
+
+    uint64_t rng_state; // Per-machine PCG32 state; seed_random() makes runs reproducible
+
+    uint8_t faults;                 // enum Fault bits raised since initialise() or the last restore
+    uint16_t fault_pc[FAULT_COUNT]; // Per bit, address of the first instruction to raise it
 
-    uint8_t keypad[16];
-    uint32_t display[SCREEN_SIZE];
-} state;
+    // Decoded instruction per address (in `shared`), filled lazily by cycle().
+    // Entries are cleared by write_memory() so self-modifying code stays correct.
+    const struct Instruction **icache;
+    struct SharedMemory *shared;
+    bool code_written; // Set when a store hit a cached instruction; translators clear it
+};
+
+typedef void (*Handler)(struct Chip8 *state, const struct Instruction *ins);
+
+// Decoded instruction: the handler plus every operand field pre-extracted
+struct Instruction {
+    Handler execute;
+    uint16_t nnn;
+    uint8_t x;
+    uint8_t y;
+    uint8_t kk;
+    uint8_t n;
+};
+
+// Indexed by the full 16-bit opcode, built once by build_decode_table()
+extern struct Instruction decode_table[0x10000];
 
 void error(const char *message, bool fatal);
-int random();
+uint8_t random_byte(struct Chip8 *state);
+
+// Machine lifecycle: every function operates on an explicit machine handle,
+// so any number of machines can run side by side (one per thread at a time)
+struct Chip8 *create_machine();
+void destroy_machine(struct Chip8 *state);
+
+// A machine can also live in caller-owned storage (e.g. shared memory): zero
+// it, initialise() it, and release_machine() it where destroy_machine() would go
+void release_machine(struct Chip8 *state);
+
+void initialise(struct Chip8 *state); // Reset machine to power-on state
+
+// Forking: a child is an exact copy of its parent (RNG included) that shares
+// memory copy-on-write, so a fork costs one small struct copy. Event handlers
+// are not inherited. Parent and children may then run on different threads.
+struct Chip8 *fork_machine(const struct Chip8 *parent);
+void copy_machine(struct Chip8 *dst, const struct Chip8 *src); // Fork into an existing machine
+void unshare_memory(struct Chip8 *state); // Gives `state` a private copy of memory; before any direct write
+
+// Forks `count` children of `parent` into `children` (creating NULL slots,
+// reusing the rest), holds keys[i] on child i (keys may be NULL to keep the
+// parent's keypad) and runs each for `cycles` instructions
+void fork_and_step(const struct Chip8 *parent, struct Chip8 **children, int count, const uint16_t *keys, uint64_t cycles);
+void seed_random(struct Chip8 *state, uint64_t seed); // initialise() seeds from the clock; call after it to reproduce a run
+
+// Keypad as a 16-bit mask, bit n set while key n is held
+uint16_t keypad_mask(const struct Chip8 *state);
+void set_keypad_mask(struct Chip8 *state, uint16_t mask);
+void set_key(struct Chip8 *state, uint8_t key, bool pressed);
+
+uint8_t *read_rom(const char *filename, size_t *size); // Caller frees
+void load_rom_data(struct Chip8 *state, const uint8_t *data, size_t size);
+void load_rom(struct Chip8 *state, const char *filename);
+
+void write_memory(struct Chip8 *state, uint16_t addr, uint8_t value); // All stores to memory go through here
+void expand_display(const struct Chip8 *state, uint32_t *pixels); // SCREEN_SIZE RGBA pixels, for presentation
+const struct Instruction *decode_at(struct Chip8 *state, uint16_t addr); // Cached decode of the opcode at addr
+struct Instruction decode_opcode(uint16_t opcode);
+void build_decode_table(); // Called by initialise(), safe from any thread
+const char *handler_name(Handler handler); // "OP_DXYN" etc., for tools and reports
+const char *fault_name(enum Fault fault); // "stack overflow" etc.
+
+void cycle(struct Chip8 *state); // Executes one instruction, no event dispatch
+
+// Timers count down at TIMER_HZ, one tick per cycles_per_frame instructions
+#define TIMER_HZ 60
+#define DEFAULT_CYCLES_PER_FRAME 10
+uint64_t current_tick(const struct Chip8 *state);
+uint8_t delay_timer(const struct Chip8 *state);
+uint8_t sound_timer(const struct Chip8 *state);
+bool sound_active(const struct Chip8 *state);
+void set_delay_timer(struct Chip8 *state, uint8_t value);
+void set_sound_timer(struct Chip8 *state, uint8_t value);
+
+void schedule_event(struct Chip8 *state, uint64_t cycle, enum EventType type); // Replaces any pending event of the same type
+void cancel_event(struct Chip8 *state, enum EventType type);
+void dispatch_events(struct Chip8 *state); // Pops and handles every event due by state->cycles
+
+// Sets run_stop to `end` or the next scheduled event, whichever is sooner.
+// Idle skips never pass run_stop, so run loops call this before stepping.
+void update_run_stop(struct Chip8 *state, uint64_t end);
 
-void initialise();
-void cleanup();
+// Runs `count` instructions, going straight through to each scheduled event
+void run_cycles(struct Chip8 *state, uint64_t count);
+void run_frame(struct Chip8 *state); // run_cycles() for one frame's worth of instructions
 
-void load_rom(const char *filename);
-void cycle();
+// For translators. The 1NNN at `addr` may be an idle loop the core fast-forwards
+// (a jump to self, or back over an FX07/3X00 delay wait), so it must go through
+// OP_1NNN. Instructions reads_cycles() accepts need state->cycles exact when they run.
+bool may_idle(const struct Instruction *ins, uint16_t addr);
+bool reads_cycles(const struct Instruction *ins, uint16_t addr);
 
 // Instructions (named after opcodes)
-void OP_NULL(); // Not a real CHIP-8 instruction, placeholder that does nothing
-void OP_00E0(); // Clear display
-void OP_00EE(); // Return from subroutine
-void OP_1NNN(); // Jump to address
-void OP_2NNN(); // Call subroutine at address
-void OP_3XKK(); // Skip next instruction if register == byte
-void OP_4XKK(); // Skip next instruction if register != byte
-void OP_5XY0(); // Skip next instruction if register X == register Y
-void OP_6XKK(); // Set register = byte
-void OP_7XKK(); // ADD byte to register
-void OP_8XY0(); // Set register X = register Y
-void OP_8XY1(); // OR register X and register Y, set register X
-void OP_8XY2(); // AND register X and register Y, set register X
-void OP_8XY3(); // XOR register X and register Y, set register X
-void OP_8XY4(); // ADD register X to register Y (VF set as carry)
-void OP_8XY5(); // SUB register Y from register X (VF set as borrow)
-void OP_8XY6(); // SHR (shift right) register X by 1 (VF set as carry if LSB is 1)
-void OP_8XY7(); // SUBN register Y from register X (VF set as NOT borrow)
-void OP_8XYE(); // SHL (shift left) register X by 1 (VF set as carry if MSB is 1)
-void OP_9XY0(); // Skip next instruction if register X != register Y
-void OP_ANNN(); // Set I to address
-void OP_BNNN(); // Jump to address + offset at V0
-void OP_CXKK(); // Set register X as random byte AND byte
-void OP_DXYN(); // Draw n-byte sprite starting from addr I at (VX, VY), set VF as collision
-void OP_EX9E(); // Skip next instruction if key with value VX is pressed
-void OP_EXA1(); // Skip next instruction if key with value VX is NOT pressed
-void OP_FX07(); // Set VX = delay timer
-void OP_FX0A(); // Wait for key press, set value of pressed key in VX
-void OP_FX15(); // Set delay timer = VX
-void OP_FX18(); // Set sound timer = VX
-void OP_FX1E(); // Set I as I + offset at VX 
-void OP_FX29(); // Set I = location of sprite for font character VX
-void OP_FX33(); // Store BCD representation of VX in I (hundreds), I + 1 (tens), I + 2 (ones)
-void OP_FX55(); // Store registers V0-VF in memory location starting at I
-void OP_FX65(); // Read registers V0-VX from memory location starting at I
+void OP_NULL(struct Chip8 *state, const struct Instruction *ins); // Not a real CHIP-8 instruction, placeholder that does nothing
+void OP_00E0(struct Chip8 *state, const struct Instruction *ins); // Clear display
+void OP_00EE(struct Chip8 *state, const struct Instruction *ins); // Return from subroutine
+void OP_1NNN(struct Chip8 *state, const struct Instruction *ins); // Jump to address
+void OP_2NNN(struct Chip8 *state, const struct Instruction *ins); // Call subroutine at address
+void OP_3XKK(struct Chip8 *state, const struct Instruction *ins); // Skip next instruction if register == byte
+void OP_4XKK(struct Chip8 *state, const struct Instruction *ins); // Skip next instruction if register != byte
+void OP_5XY0(struct Chip8 *state, const struct Instruction *ins); // Skip next instruction if register X == register Y
+void OP_6XKK(struct Chip8 *state, const struct Instruction *ins); // Set register = byte
+void OP_7XKK(struct Chip8 *state, const struct Instruction *ins); // ADD byte to register
+void OP_8XY0(struct Chip8 *state, const struct Instruction *ins); // Set register X = register Y
+void OP_8XY1(struct Chip8 *state, const struct Instruction *ins); // OR register X and register Y, set register X
+void OP_8XY2(struct Chip8 *state, const struct Instruction *ins); // AND register X and register Y, set register X
+void OP_8XY3(struct Chip8 *state, const struct Instruction *ins); // XOR register X and register Y, set register X
+void OP_8XY4(struct Chip8 *state, const struct Instruction *ins); // ADD register X to register Y (VF set as carry)
+void OP_8XY5(struct Chip8 *state, const struct Instruction *ins); // SUB register Y from register X (VF set as borrow)
+void OP_8XY6(struct Chip8 *state, const struct Instruction *ins); // SHR (shift right) register X by 1 (VF set as carry if LSB is 1)
+void OP_8XY7(struct Chip8 *state, const struct Instruction *ins); // SUBN register Y from register X (VF set as NOT borrow)
+void OP_8XYE(struct Chip8 *state, const struct Instruction *ins); // SHL (shift left) register X by 1 (VF set as carry if MSB is 1)
+void OP_9XY0(struct Chip8 *state, const struct Instruction *ins); // Skip next instruction if register X != register Y
+void OP_ANNN(struct Chip8 *state, const struct Instruction *ins); // Set I to address
+void OP_BNNN(struct Chip8 *state, const struct Instruction *ins); // Jump to address + offset at V0
+void OP_CXKK(struct Chip8 *state, const struct Instruction *ins); // Set register X as random byte AND byte
+void OP_DXYN(struct Chip8 *state, const struct Instruction *ins); // Draw n-byte sprite starting from addr I at (VX, VY), set VF as collision
+void OP_EX9E(struct Chip8 *state, const struct Instruction *ins); // Skip next instruction if key with value VX is pressed
+void OP_EXA1(struct Chip8 *state, const struct Instruction *ins); // Skip next instruction if key with value VX is NOT pressed
+void OP_FX07(struct Chip8 *state, const struct Instruction *ins); // Set VX = delay timer
+void OP_FX0A(struct Chip8 *state, const struct Instruction *ins); // Wait for key press, set value of pressed key in VX
+void OP_FX15(struct Chip8 *state, const struct Instruction *ins); // Set delay timer = VX
+void OP_FX18(struct Chip8 *state, const struct Instruction *ins); // Set sound timer = VX
+void OP_FX1E(struct Chip8 *state, const struct Instruction *ins); // Set I as I + offset at VX 
+void OP_FX29(struct Chip8 *state, const struct Instruction *ins); // Set I = location of sprite for font character VX
+void OP_FX33(struct Chip8 *state, const struct Instruction *ins); // Store BCD representation of VX in I (hundreds), I + 1 (tens), I + 2 (ones)
+void OP_FX55(struct Chip8 *state, const struct Instruction *ins); // Store registers V0-VF in memory location starting at I
+void OP_FX65(struct Chip8 *state, const struct Instruction *ins); // Read registers V0-VX from memory location starting at I
 
 #endif
@@ -0,0 +1,227 @@
+#include "env.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#define SPIN_LIMIT 4000          // Polls before sleeping on the futex; a round trip is usually shorter
+#define LIVENESS_NS 100000000    // A sleeping client checks the server is still alive this often
+
+static long futex(uint32_t *word, int op, uint32_t value, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+// Spinning only pays when the other side can run at the same time
+static int spin_limit() {
+    static int limit = -1;
+
+    if (limit < 0) limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+
+    return limit;
+}
+
+// Publishes `value` and wakes the other side if it went to sleep waiting for it
+static void ring(uint32_t *word, uint32_t *waiting, uint32_t value) {
+    __atomic_store_n(word, value, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) futex(word, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+// Waits for *word to move off `old`. With a `peer` it gives up once that
+// process no longer exists.
+static bool wait_for_change(uint32_t *word, uint32_t *waiting, uint32_t old, pid_t peer) {
+    for (int i = 0; i < spin_limit(); i++) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != old) return true;
+        cpu_relax();
+    }
+
+    struct timespec timeout = {0, LIVENESS_NS};
+    bool alive = true;
+
+    // Announce the sleep before the final check, so a ring() in between sees it
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(word, __ATOMIC_SEQ_CST) == old) {
+        futex(word, FUTEX_WAIT, old, peer ? &timeout : NULL);
+
+        if (peer != 0 && __atomic_load_n(word, __ATOMIC_SEQ_CST) == old && kill(peer, 0) != 0 && errno == ESRCH) {
+            alive = false;
+            break;
+        }
+    }
+
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+    return alive;
+}
+
+struct EnvRegion *create_env(const char *name) {
+    shm_unlink(name); // Left behind by a server that was killed
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+    if (fd < 0) {
+        error("Failed to create environment region", false);
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(struct EnvRegion)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        error("Failed to size environment region", false);
+        return NULL;
+    }
+
+    struct EnvRegion *region = (struct EnvRegion *)mmap(NULL, sizeof(struct EnvRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (region == MAP_FAILED) {
+        shm_unlink(name);
+        error("Failed to map environment region", false);
+        return NULL;
+    }
+
+    // Fresh pages are zero, so machine.shared is NULL as initialise() expects
+    region->version = ENV_VERSION;
+    region->machine_size = sizeof(struct Chip8);
+
+    return region;
+}
+
+void destroy_env(struct EnvRegion *region, const char *name) {
+    munmap(region, sizeof(struct EnvRegion));
+    shm_unlink(name);
+}
+
+static void observe(struct EnvRegion *region, uint32_t flags) {
+    region->sound = sound_active(&region->machine);
+
+    if (flags & ENV_RGBA) expand_display(&region->machine, region->pixels);
+}
+
+static void reset_machine(struct EnvRegion *region, const uint8_t *rom, size_t rom_size, uint32_t cycles_per_frame, uint64_t seed) {
+    struct Chip8 *state = &region->machine;
+
+    initialise(state);
+    seed_random(state, seed);
+    state->cycles_per_frame = cycles_per_frame;
+    load_rom_data(state, rom, rom_size);
+
+    region->frame = 0;
+}
+
+void serve_env(struct EnvRegion *region, const uint8_t *rom, size_t rom_size, uint32_t cycles_per_frame, uint64_t seed) {
+    struct Chip8 *state = &region->machine;
+
+    reset_machine(region, rom, rom_size, cycles_per_frame, seed);
+    observe(region, ENV_RGBA);
+
+    region->server_pid = getpid();
+    __atomic_store_n(&region->magic, ENV_MAGIC, __ATOMIC_RELEASE); // Attaching is refused until now
+
+    uint32_t seen = __atomic_load_n(&region->request, __ATOMIC_ACQUIRE);
+
+    while (true) {
+        wait_for_change(&region->request, &region->server_waiting, seen, 0);
+        seen = __atomic_load_n(&region->request, __ATOMIC_ACQUIRE);
+
+        enum EnvCommand command = (enum EnvCommand)region->command;
+
+        switch (command) {
+            case ENV_STEP:
+                set_keypad_mask(state, region->keys);
+
+                for (uint32_t i = 0; i < region->frames; i++) run_frame(state);
+
+                region->frame += region->frames;
+                break;
+
+            case ENV_RESET:
+                reset_machine(region, rom, rom_size, cycles_per_frame, region->seed);
+                break;
+
+            case ENV_QUIT:
+                break;
+        }
+
+        observe(region, region->flags);
+        ring(&region->response, &region->client_waiting, seen);
+
+        if (command == ENV_QUIT) break;
+    }
+
+    // Machine memory is on this process's heap, which may not be the one
+    // that calls destroy_env()
+    __atomic_store_n(&region->magic, 0, __ATOMIC_RELEASE);
+    release_machine(state);
+}
+
+struct EnvRegion *attach_env(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    struct stat st;
+
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &st) != 0 || st.st_size != sizeof(struct EnvRegion)) {
+        close(fd);
+        error("Environment region has the wrong size", false);
+        return NULL;
+    }
+
+    struct EnvRegion *region = (struct EnvRegion *)mmap(NULL, sizeof(struct EnvRegion), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (region == MAP_FAILED) return NULL;
+
+    if (__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) != ENV_MAGIC || region->version != ENV_VERSION ||
+        region->machine_size != sizeof(struct Chip8)) {
+        munmap(region, sizeof(struct EnvRegion));
+        return NULL; // Not served yet, or by another build
+    }
+
+    return region;
+}
+
+void detach_env(struct EnvRegion *region) {
+    munmap(region, sizeof(struct EnvRegion));
+}
+
+static bool call(struct EnvRegion *region, enum EnvCommand command, uint32_t flags) {
+    uint32_t old = __atomic_load_n(&region->response, __ATOMIC_ACQUIRE); // Equals request while idle
+
+    region->command = command;
+    region->flags = flags;
+    ring(&region->request, &region->server_waiting, old + 1);
+
+    return wait_for_change(&region->response, &region->client_waiting, old, region->server_pid);
+}
+
+bool env_step(struct EnvRegion *region, uint16_t keys, uint32_t frames, uint32_t flags) {
+    region->keys = keys;
+    region->frames = frames;
+    return call(region, ENV_STEP, flags);
+}
+
+bool env_reset(struct EnvRegion *region, uint64_t seed) {
+    region->seed = seed;
+    return call(region, ENV_RESET, ENV_RGBA);
+}
+
+bool env_quit(struct EnvRegion *region) {
+    return call(region, ENV_QUIT, 0);
+}
@@ -0,0 +1,76 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include "chip8.h"
+
+#include <sys/types.h>
+
+// Shared-memory environment for driving a machine from another process. The
+// server keeps its live Chip8 inside a POSIX shared-memory region, so a client
+// reads the display, registers and keypad straight out of it with no copying
+// or serialisation. Requests ("hold these keys, run N frames") go through a
+// futex doorbell. The region is created mode 0600, so only the owning user on
+// the same host can attach.
+//
+// Protocol: the client fills the request fields and bumps `request`; the
+// server runs it and sets `response` to the same value. Between a response and
+// the next request the region belongs to the client, which must treat
+// `machine` as read-only (its pointer fields are server addresses).
+
+#define ENV_MAGIC 0x564E4543 // "CENV"
+#define ENV_VERSION 1
+#define DEFAULT_ENV_NAME "/chip8-env"
+
+enum EnvCommand {
+    ENV_STEP,  // Hold `keys` and run `frames` frames (0 just refreshes the observation)
+    ENV_RESET, // Power on, reseed with `seed` and reload the ROM
+    ENV_QUIT,  // serve_env() returns
+};
+
+#define ENV_RGBA 0x1 // Request flag: also expand the display into `pixels`
+
+struct EnvRegion {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t machine_size; // sizeof(struct Chip8) in the server, so mismatched builds refuse to attach
+    pid_t server_pid;
+
+    // Doorbell, one cache line per writer. Each *_waiting word is set while
+    // that side sleeps on the futex, so the other only syscalls to wake it then.
+    _Alignas(64) uint32_t request;
+    uint32_t server_waiting;
+    _Alignas(64) uint32_t response;
+    uint32_t client_waiting;
+
+    // Request, written by the client
+    _Alignas(64) uint32_t command; // enum EnvCommand
+    uint32_t flags;
+    uint16_t keys;
+    uint32_t frames;
+    uint64_t seed;
+
+    // Observation, written by the server along with `machine`
+    uint64_t frame; // Frames run since the last reset
+    bool sound;     // Sound timer running
+
+    _Alignas(64) struct Chip8 machine;
+    _Alignas(64) uint32_t pixels[SCREEN_SIZE]; // Only refreshed for ENV_RGBA requests
+};
+
+// Server: create_env() makes (replacing any stale one) and maps the region;
+// serve_env() resets the machine, opens the region to clients and answers one
+// client at a time until ENV_QUIT
+struct EnvRegion *create_env(const char *name);
+void serve_env(struct EnvRegion *region, const uint8_t *rom, size_t rom_size, uint32_t cycles_per_frame, uint64_t seed);
+void destroy_env(struct EnvRegion *region, const char *name); // Unmaps and unlinks, after serve_env() has returned
+
+// Client: each call blocks until the server has answered, and returns false
+// if the server went away instead
+struct EnvRegion *attach_env(const char *name); // NULL if missing, not yet served or from another build
+void detach_env(struct EnvRegion *region);
+bool env_step(struct EnvRegion *region, uint16_t keys, uint32_t frames, uint32_t flags);
+bool env_reset(struct EnvRegion *region, uint64_t seed);
+bool env_quit(struct EnvRegion *region);
+
+#endif
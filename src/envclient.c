@@ -0,0 +1,110 @@
+// Reference environment client: attaches to a running chip8-env, resets it,
+// then plays random keys for a number of steps, reading the observation
+// straight out of the shared region. A template for real agents.
+// Build: cc -O2 -pthread src/envclient.c src/env.c src/chip8.c -o chip8-env-client
+
+#include "env.h"
+
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_STEPS 1000
+#define ATTACH_TIMEOUT_MS 2000
+
+static double seconds_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_display(const struct Chip8 *state) {
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            putchar((state->display[y] >> (SCREEN_WIDTH - 1 - x)) & 1 ? '#' : '.');
+        }
+
+        putchar('\n');
+    }
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: chip8-env-client [options]\n"
+            "  -n NAME    shared-memory region name (default %s)\n"
+            "  -k STEPS   steps to take (default %d)\n"
+            "  -f FRAMES  frames per step (default 1)\n"
+            "  -s SEED    reset seed, also seeds the key policy (default 1)\n"
+            "  -r         request RGBA pixels as well as the packed display\n"
+            "  -q         stop the server when done\n",
+            DEFAULT_ENV_NAME, DEFAULT_STEPS);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    const char *name = DEFAULT_ENV_NAME;
+    long steps = DEFAULT_STEPS;
+    uint32_t frames = 1;
+    uint64_t seed = 1;
+    uint32_t flags = 0;
+    bool quit = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:k:f:s:rq")) != -1) {
+        switch (opt) {
+            case 'n': name = optarg; break;
+            case 'k': steps = atol(optarg); break;
+            case 'f': frames = strtoul(optarg, NULL, 0); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            case 'r': flags |= ENV_RGBA; break;
+            case 'q': quit = true; break;
+            default: usage();
+        }
+    }
+
+    if (optind != argc || steps < 0) usage();
+
+    // The server may still be starting up
+    struct EnvRegion *region = NULL;
+
+    for (int waited = 0; (region = attach_env(name)) == NULL; waited += 10) {
+        if (waited >= ATTACH_TIMEOUT_MS) error("No environment server is running", true);
+        usleep(10000);
+    }
+
+    if (!env_reset(region, seed)) error("Environment server went away", true);
+
+    const struct Chip8 *state = &region->machine;
+    uint64_t policy = seed * 0x9E3779B97F4A7C15ULL | 1;
+    uint32_t generation = state->display_generation;
+    long redraws = 0;
+    double start = seconds_now();
+
+    for (long i = 0; i < steps; i++) {
+        // Random policy: hold one key (or none) per step
+        policy ^= policy << 13;
+        policy ^= policy >> 7;
+        policy ^= policy << 17;
+
+        int key = policy % 17;
+
+        if (!env_step(region, key < 16 ? 1 << key : 0, frames, flags)) error("Environment server went away", true);
+
+        if (state->display_generation != generation) {
+            generation = state->display_generation;
+            redraws++;
+        }
+    }
+
+    double elapsed = seconds_now() - start;
+
+    print_display(state);
+    printf("steps=%ld frames=%llu redraws=%ld pc=%03X I=%03X sound=%d\n", steps, (unsigned long long)region->frame, redraws,
+           state->pc, state->index, region->sound);
+    printf("%.0f steps/s, %.2f us/step\n", steps / elapsed, steps ? elapsed * 1e6 / steps : 0.0);
+
+    if (quit) env_quit(region);
+
+    detach_env(region);
+    return 0;
+}
@@ -0,0 +1,65 @@
+// Environment server: runs one machine inside a shared-memory region that a
+// training process on the same host attaches to with attach_env() (see env.h
+// and the reference client in envclient.c). No SDL required.
+// Build: cc -O2 -pthread src/envserver.c src/env.c src/chip8.c -o chip8-env
+
+#include "env.h"
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static const char *region_name = DEFAULT_ENV_NAME;
+
+// Killed while serving: don't leave the region behind in /dev/shm
+static void on_signal(int signal) {
+    (void)signal;
+    shm_unlink(region_name);
+    _exit(1);
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: chip8-env [options] ROM\n"
+            "  -n NAME    shared-memory region name (default %s)\n"
+            "  -i CYCLES  instructions per frame (default %d)\n"
+            "  -s SEED    RNG seed until a client resets with its own (default 1)\n",
+            DEFAULT_ENV_NAME, DEFAULT_CYCLES_PER_FRAME);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:i:s:")) != -1) {
+        switch (opt) {
+            case 'n': region_name = optarg; break;
+            case 'i': cycles_per_frame = strtoul(optarg, NULL, 0); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            default: usage();
+        }
+    }
+
+    if (optind != argc - 1 || cycles_per_frame < 1) usage();
+
+    size_t rom_size;
+    uint8_t *rom = read_rom(argv[optind], &rom_size);
+
+    struct EnvRegion *region = create_env(region_name);
+
+    if (region == NULL) error("Failed to set up environment", true);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    printf("serving %s on %s (%zu bytes)\n", argv[optind], region_name, sizeof(struct EnvRegion));
+    fflush(stdout);
+
+    serve_env(region, rom, rom_size, cycles_per_frame, seed);
+
+    destroy_env(region, region_name);
+    free(rom);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "frames.h"
+
+#include <string.h>
+
+#define BAR_WIDTH 50
+
+void initialise_triple_buffer(struct TripleBuffer *buffer) {
+    memset(buffer, 0, sizeof(*buffer));
+
+    buffer->back = 0;
+    buffer->middle = 1;
+    buffer->front = 2;
+}
+
+struct Frame *back_frame(struct TripleBuffer *buffer) {
+    return &buffer->slots[buffer->back];
+}
+
+void publish_frame(struct TripleBuffer *buffer) {
+    // Release: the frame's contents are visible before its slot is
+    uint8_t old = __atomic_exchange_n(&buffer->middle, buffer->back | FRAME_FRESH, __ATOMIC_ACQ_REL);
+
+    buffer->back = old & ~FRAME_FRESH; // An untaken frame is simply overwritten next time
+}
+
+bool frame_ready(const struct TripleBuffer *buffer) {
+    return __atomic_load_n(&buffer->middle, __ATOMIC_RELAXED) & FRAME_FRESH;
+}
+
+const struct Frame *take_frame(struct TripleBuffer *buffer) {
+    if (!frame_ready(buffer)) return NULL;
+
+    uint8_t old = __atomic_exchange_n(&buffer->middle, buffer->front, __ATOMIC_ACQ_REL);
+
+    buffer->front = old & ~FRAME_FRESH;
+    return &buffer->slots[buffer->front];
+}
+
+void record_latency(struct LatencyHistogram *histogram, uint64_t ns) {
+    uint64_t bucket = ns / LATENCY_BUCKET_NS;
+
+    histogram->counts[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1]++;
+    histogram->samples++;
+    histogram->total_ns += ns;
+
+    if (ns > histogram->max_ns) histogram->max_ns = ns;
+}
+
+// Upper edge of the bucket holding the given rank, in ms
+static double percentile_ms(const struct LatencyHistogram *histogram, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * (histogram->samples - 1)) + 1;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) return (i + 1) * (LATENCY_BUCKET_NS / 1e6);
+    }
+
+    return histogram->max_ns / 1e6;
+}
+
+void write_latency_report(const struct LatencyHistogram *histogram, FILE *fp) {
+    if (histogram->samples == 0) {
+        fprintf(fp, "key-to-photon latency: no samples\n");
+        return;
+    }
+
+    fprintf(fp, "key-to-photon latency: %llu samples, mean %.2f ms, p50 <%.0f ms, p90 <%.0f ms, p99 <%.0f ms, max %.2f ms\n",
+            (unsigned long long)histogram->samples, histogram->total_ns / 1e6 / histogram->samples,
+            percentile_ms(histogram, 0.5), percentile_ms(histogram, 0.9), percentile_ms(histogram, 0.99),
+            histogram->max_ns / 1e6);
+
+    uint64_t peak = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (histogram->counts[i] > peak) peak = histogram->counts[i];
+    }
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        if (histogram->counts[i] == 0) continue;
+
+        int width = (int)((histogram->counts[i] * BAR_WIDTH + peak - 1) / peak);
+
+        fprintf(fp, "  %3d%s ms %8llu ", i, i == LATENCY_BUCKETS - 1 ? "+" : " ", (unsigned long long)histogram->counts[i]);
+
+        for (int j = 0; j < width; j++) fputc('#', fp);
+        fputc('\n', fp);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include "chip8.h"
+
+// Hand-off of finished frames from the emulator thread to the render thread.
+// A triple buffer: the writer always has a back slot of its own, the reader
+// a front slot, and the middle slot is swapped atomically, so neither side
+// ever waits and the reader always gets the newest complete frame.
+
+struct Frame {
+    uint64_t display[SCREEN_HEIGHT];
+    uint32_t generation; // display_generation it was taken at
+    uint64_t input_ns;   // monotonic_ns() of the key press this frame first answers, 0 if none
+};
+
+#define FRAME_FRESH 0x4 // Set in `middle` while it holds a frame the reader hasn't taken
+
+struct TripleBuffer {
+    struct Frame slots[3];
+    uint8_t back;   // Writer's slot
+    uint8_t front;  // Reader's slot
+    uint8_t middle; // Slot index | FRAME_FRESH, swapped atomically
+};
+
+void initialise_triple_buffer(struct TripleBuffer *buffer);
+
+// Writer: fill the back slot, then publish it
+struct Frame *back_frame(struct TripleBuffer *buffer);
+void publish_frame(struct TripleBuffer *buffer);
+
+// Reader: the newest published frame, or NULL if nothing new since last time
+const struct Frame *take_frame(struct TripleBuffer *buffer);
+bool frame_ready(const struct TripleBuffer *buffer); // take_frame() would return one
+
+// Key-to-photon latency, in LATENCY_BUCKET_NS buckets
+#define LATENCY_BUCKET_NS 1000000
+#define LATENCY_BUCKETS 100 // The last one also counts everything slower
+
+struct LatencyHistogram {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t samples;
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+void record_latency(struct LatencyHistogram *histogram, uint64_t ns);
+void write_latency_report(const struct LatencyHistogram *histogram, FILE *fp);
+
+#endif
@@ -0,0 +1,402 @@
+// Coverage-guided keypad fuzzer: forks one starting machine per input, drives
+// it with a mutated key mask per frame, and keeps every input that reaches a
+// new PC or (PC, opcode) pair. Faults the core records are reported with the
+// input that triggered them. No SDL required.
+// Build: cc -O2 -pthread src/fuzz.c src/chip8.c src/savestate.c -o chip8-fuzz
+
+#include "chip8.h"
+#include "savestate.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_FRAMES 120
+#define DEFAULT_SECONDS 10
+#define MAX_STACKED_MUTATIONS 4
+
+// Coverage maps, shared by all workers. A (PC, opcode) pair is 28 bits, so its
+// map is an exact 32 MB bitmap rather than a hash; pages stay untouched until hit.
+#define PAIR_BITS (MEMORY_SIZE * 0x10000)
+
+struct Corpus {
+    pthread_mutex_t lock;
+    uint16_t **inputs; // Each `frames` key masks long
+    size_t count;
+    size_t capacity;
+};
+
+struct Fuzzer {
+    const struct Chip8 *start;
+    int frames;
+
+    uint64_t pc_map[MEMORY_SIZE / 64];
+    uint64_t *pair_map;
+    uint64_t pcs_covered;
+    uint64_t pairs_covered;
+
+    struct Corpus corpus;
+
+    // First input seen per (fault, PC); guarded by the corpus lock
+    uint8_t fault_seen[FAULT_COUNT][MEMORY_SIZE];
+    uint64_t unique_faults;
+
+    const char *output_dir;
+    bool stop;
+};
+
+struct Worker {
+    pthread_t thread;
+    struct Fuzzer *fuzzer;
+    unsigned int seed;
+
+    uint16_t *input;
+    bool new_coverage;
+    uint64_t fault_cycle[FAULT_COUNT]; // Per bit, cycle of the instruction that first raised it this run
+    uint64_t executed; // Instructions, private to the worker
+
+    // Published once per input for the progress line
+    uint64_t execs;
+    uint64_t instructions;
+};
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Sets `bit` in `map`; true if it was clear. Checked first without the atomic,
+// since almost every hit is on code already covered.
+static bool mark(uint64_t *map, uint64_t *covered, uint32_t bit) {
+    uint64_t mask = 1ULL << (bit & 63);
+    uint64_t *word = &map[bit >> 6];
+
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & mask) return false;
+    if (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) return false;
+
+    __atomic_add_fetch(covered, 1, __ATOMIC_RELAXED);
+    return true;
+}
+
+static void fuzz_cycle(struct Worker *worker, struct Chip8 *state) {
+    struct Fuzzer *fuzzer = worker->fuzzer;
+    uint16_t pc = state->pc & (MEMORY_SIZE - 1);
+    uint16_t opcode = decode_at(state, pc) - decode_table;
+
+    if (mark(fuzzer->pc_map, &fuzzer->pcs_covered, pc)) worker->new_coverage = true;
+    if (mark(fuzzer->pair_map, &fuzzer->pairs_covered, (uint32_t)pc << 16 | opcode)) worker->new_coverage = true;
+
+    uint8_t faults = state->faults;
+
+    cycle(state);
+    worker->executed++;
+
+    // Faults are only checked between frames, so note when each one was raised
+    if (state->faults != faults) {
+        for (int f = 0; f < FAULT_COUNT; f++) {
+            if ((state->faults & ~faults) & (1 << f)) worker->fault_cycle[f] = state->cycles;
+        }
+    }
+}
+
+// run_cycles() with every instruction recorded
+static void run_cycles_covered(struct Worker *worker, struct Chip8 *state, uint64_t count) {
+    uint64_t end = state->cycles + count;
+
+    while (state->cycles < end) {
+        update_run_stop(state, end);
+
+        while (state->cycles < state->run_stop) fuzz_cycle(worker, state);
+
+        dispatch_events(state);
+    }
+}
+
+static void write_input(const struct Fuzzer *fuzzer, const uint16_t *input, const char *name) {
+    char path[4096];
+    FILE *fp;
+
+    if (fuzzer->output_dir == NULL) return;
+
+    snprintf(path, sizeof(path), "%s/%s.keys", fuzzer->output_dir, name);
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        error("Failed to write fuzz input", false);
+        return;
+    }
+
+    // One little-endian key mask per frame
+    for (int f = 0; f < fuzzer->frames; f++) {
+        fputc(input[f] & 0xFF, fp);
+        fputc(input[f] >> 8, fp);
+    }
+
+    fclose(fp);
+}
+
+// Takes a copy of `input`; caller holds the corpus lock
+static void add_input(struct Fuzzer *fuzzer, const uint16_t *input) {
+    struct Corpus *corpus = &fuzzer->corpus;
+
+    if (corpus->count == corpus->capacity) {
+        corpus->capacity = corpus->capacity ? corpus->capacity * 2 : 64;
+        corpus->inputs = (uint16_t **)realloc(corpus->inputs, corpus->capacity * sizeof(uint16_t *));
+
+        if (corpus->inputs == NULL) error("Failed to grow corpus", true);
+    }
+
+    uint16_t *copy = (uint16_t *)malloc(fuzzer->frames * sizeof(uint16_t));
+
+    if (copy == NULL) error("Failed to grow corpus", true);
+
+    memcpy(copy, input, fuzzer->frames * sizeof(uint16_t));
+    corpus->inputs[corpus->count++] = copy;
+}
+
+static void record_faults(struct Worker *worker, const struct Chip8 *state) {
+    struct Fuzzer *fuzzer = worker->fuzzer;
+
+    for (int f = 0; f < FAULT_COUNT; f++) {
+        uint16_t pc = state->fault_pc[f];
+
+        if (!(state->faults & (1 << f)) || fuzzer->fault_seen[f][pc]) continue;
+
+        char name[64];
+
+        fuzzer->fault_seen[f][pc] = 1;
+        fuzzer->unique_faults++;
+
+        printf("fault: %s at %03X (cycle %llu)\n", fault_name((enum Fault)(1 << f)), pc,
+               (unsigned long long)worker->fault_cycle[f]);
+
+        snprintf(name, sizeof(name), "fault-%d-%03X", f, pc);
+        write_input(fuzzer, worker->input, name);
+    }
+}
+
+static void mutate(struct Worker *worker, uint16_t *input) {
+    struct Fuzzer *fuzzer = worker->fuzzer;
+    int frames = fuzzer->frames;
+    int count = 1 + rand_r(&worker->seed) % MAX_STACKED_MUTATIONS;
+
+    for (int m = 0; m < count; m++) {
+        int from = rand_r(&worker->seed) % frames;
+        int length = 1 + rand_r(&worker->seed) % (frames - from);
+        uint16_t key = 1 << (rand_r(&worker->seed) % 16);
+
+        switch (rand_r(&worker->seed) % 5) {
+            case 0: // Press or release one key over a run of frames
+                for (int f = from; f < from + length; f++) input[f] ^= key;
+                break;
+
+            case 1: // Hold exactly one key (or none) over a run
+                if (rand_r(&worker->seed) % 4 == 0) key = 0;
+                for (int f = from; f < from + length; f++) input[f] = key;
+                break;
+
+            case 2: // Random mask on one frame
+                input[from] = (uint16_t)rand_r(&worker->seed);
+                break;
+
+            case 3: // Delay or advance everything after `from` by a frame
+                if (rand_r(&worker->seed) & 1) {
+                    memmove(&input[from + 1], &input[from], (frames - from - 1) * sizeof(uint16_t));
+                } else {
+                    memmove(&input[from], &input[from + 1], (frames - from - 1) * sizeof(uint16_t));
+                }
+                break;
+
+            case 4: { // Splice in the tail of another corpus entry
+                pthread_mutex_lock(&fuzzer->corpus.lock);
+                const uint16_t *other = fuzzer->corpus.inputs[rand_r(&worker->seed) % fuzzer->corpus.count];
+                memcpy(&input[from], &other[from], (frames - from) * sizeof(uint16_t));
+                pthread_mutex_unlock(&fuzzer->corpus.lock);
+                break;
+            }
+        }
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct Worker *worker = (struct Worker *)arg;
+    struct Fuzzer *fuzzer = worker->fuzzer;
+    struct Chip8 *machine = fork_machine(fuzzer->start);
+
+    while (!__atomic_load_n(&fuzzer->stop, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&fuzzer->corpus.lock);
+        memcpy(worker->input, fuzzer->corpus.inputs[rand_r(&worker->seed) % fuzzer->corpus.count],
+               fuzzer->frames * sizeof(uint16_t));
+        pthread_mutex_unlock(&fuzzer->corpus.lock);
+
+        mutate(worker, worker->input);
+
+        // Every run starts from the same snapshot, sharing its memory until a store
+        copy_machine(machine, fuzzer->start);
+        worker->new_coverage = false;
+
+        for (int f = 0; f < fuzzer->frames && machine->faults == 0; f++) {
+            set_keypad_mask(machine, worker->input[f]);
+            run_cycles_covered(worker, machine, machine->cycles_per_frame);
+        }
+
+        __atomic_store_n(&worker->execs, worker->execs + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&worker->instructions, worker->executed, __ATOMIC_RELAXED);
+
+        if (worker->new_coverage || machine->faults != 0) {
+            pthread_mutex_lock(&fuzzer->corpus.lock);
+
+            if (machine->faults != 0) record_faults(worker, machine);
+
+            if (worker->new_coverage) {
+                char name[32];
+
+                snprintf(name, sizeof(name), "cov-%06zu", fuzzer->corpus.count);
+                write_input(fuzzer, worker->input, name);
+                add_input(fuzzer, worker->input);
+            }
+
+            pthread_mutex_unlock(&fuzzer->corpus.lock);
+        }
+    }
+
+    destroy_machine(machine);
+    return NULL;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: chip8-fuzz [options] ROM\n"
+            "  -S FILE     start from this save state instead of power-on\n"
+            "  -t THREADS  worker threads (default: online CPUs)\n"
+            "  -f FRAMES   frames per input (default %d)\n"
+            "  -i CYCLES   instructions per frame (default %d; a save state sets its own)\n"
+            "  -d SECONDS  how long to fuzz (default %d)\n"
+            "  -s SEED     machine RNG and mutation seed (default 1)\n"
+            "  -o DIR      write new-coverage and faulting inputs here, as one\n"
+            "              little-endian key mask per frame\n",
+            DEFAULT_FRAMES, DEFAULT_CYCLES_PER_FRAME, DEFAULT_SECONDS);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int frames = DEFAULT_FRAMES;
+    uint32_t cycles_per_frame = DEFAULT_CYCLES_PER_FRAME;
+    double seconds = DEFAULT_SECONDS;
+    unsigned int seed = 1;
+    const char *state_file = NULL;
+    const char *output_dir = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "S:t:f:i:d:s:o:")) != -1) {
+        switch (opt) {
+            case 'S': state_file = optarg; break;
+            case 't': threads = atol(optarg); break;
+            case 'f': frames = atoi(optarg); break;
+            case 'i': cycles_per_frame = strtoul(optarg, NULL, 0); break;
+            case 'd': seconds = atof(optarg); break;
+            case 's': seed = strtoul(optarg, NULL, 0); break;
+            case 'o': output_dir = optarg; break;
+            default: usage();
+        }
+    }
+
+    if (optind != argc - 1 || threads < 1 || frames < 1 || cycles_per_frame < 1) usage();
+
+    struct Chip8 *start = create_machine();
+
+    seed_random(start, seed);
+    start->cycles_per_frame = cycles_per_frame;
+    load_rom(start, argv[optind]);
+
+    if (state_file != NULL && !restore_state_file(start, state_file)) error("Failed to load save state", true);
+
+    if (output_dir != NULL) mkdir(output_dir, 0755);
+
+    struct Fuzzer *fuzzer = (struct Fuzzer *)calloc(1, sizeof(struct Fuzzer));
+
+    if (fuzzer == NULL) error("Failed to allocate fuzzer", true);
+
+    fuzzer->start = start;
+    fuzzer->frames = frames;
+    fuzzer->output_dir = output_dir;
+    fuzzer->pair_map = (uint64_t *)calloc(PAIR_BITS / 64, sizeof(uint64_t));
+
+    if (fuzzer->pair_map == NULL) error("Failed to allocate coverage map", true);
+
+    pthread_mutex_init(&fuzzer->corpus.lock, NULL);
+
+    // Seeds: no keys, then each key held for the whole run
+    uint16_t *input = (uint16_t *)calloc(frames, sizeof(uint16_t));
+
+    add_input(fuzzer, input);
+
+    for (int key = 0; key < 16; key++) {
+        for (int f = 0; f < frames; f++) input[f] = 1 << key;
+        add_input(fuzzer, input);
+    }
+
+    free(input);
+
+    struct Worker *workers = (struct Worker *)calloc(threads, sizeof(struct Worker));
+
+    for (int w = 0; w < threads; w++) {
+        workers[w].fuzzer = fuzzer;
+        workers[w].seed = seed * 7919 + w;
+        workers[w].input = (uint16_t *)malloc(frames * sizeof(uint16_t));
+    }
+
+    double begin = now_seconds();
+
+    for (int w = 0; w < threads; w++) {
+        if (pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]) != 0) {
+            error("Failed to start worker thread", true);
+        }
+    }
+
+    // Progress once a second; workers read `stop` between inputs
+    double elapsed = 0;
+
+    while (elapsed < seconds) {
+        double nap = seconds - elapsed < 1 ? seconds - elapsed : 1;
+
+        usleep((useconds_t)(nap * 1e6));
+        elapsed = now_seconds() - begin;
+
+        uint64_t execs = 0;
+        uint64_t instructions = 0;
+
+        for (int w = 0; w < threads; w++) {
+            execs += __atomic_load_n(&workers[w].execs, __ATOMIC_RELAXED);
+            instructions += __atomic_load_n(&workers[w].instructions, __ATOMIC_RELAXED);
+        }
+
+        pthread_mutex_lock(&fuzzer->corpus.lock);
+        printf("%6.1fs execs=%llu (%.0f/s) ips=%.0f pcs=%llu pairs=%llu corpus=%zu faults=%llu\n", elapsed,
+               (unsigned long long)execs, execs / elapsed, instructions / elapsed,
+               (unsigned long long)__atomic_load_n(&fuzzer->pcs_covered, __ATOMIC_RELAXED),
+               (unsigned long long)__atomic_load_n(&fuzzer->pairs_covered, __ATOMIC_RELAXED),
+               fuzzer->corpus.count, (unsigned long long)fuzzer->unique_faults);
+        pthread_mutex_unlock(&fuzzer->corpus.lock);
+        fflush(stdout);
+    }
+
+    __atomic_store_n(&fuzzer->stop, true, __ATOMIC_RELAXED);
+
+    for (int w = 0; w < threads; w++) pthread_join(workers[w].thread, NULL);
+
+    for (int w = 0; w < threads; w++) free(workers[w].input);
+    for (size_t i = 0; i < fuzzer->corpus.count; i++) free(fuzzer->corpus.inputs[i]);
+
+    pthread_mutex_destroy(&fuzzer->corpus.lock);
+    free(fuzzer->corpus.inputs);
+    free(fuzzer->pair_map);
+    free(fuzzer);
+    free(workers);
+    destroy_machine(start);
+
+    return 0;
+}
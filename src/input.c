@@ -0,0 +1,37 @@
+#include "input.h"
+
+#include <string.h>
+
+void initialise_input_ring(struct InputRing *ring) {
+    memset(ring, 0, sizeof(*ring));
+}
+
+bool push_key_event(struct InputRing *ring, const struct KeyEvent *event) {
+    uint32_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == INPUT_RING_SIZE) return false;
+
+    ring->events[head & (INPUT_RING_SIZE - 1)] = *event;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+const struct KeyEvent *peek_key_event(struct InputRing *ring) {
+    uint32_t tail = ring->tail;
+
+    if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) return NULL;
+
+    return &ring->events[tail & (INPUT_RING_SIZE - 1)];
+}
+
+void pop_key_event(struct InputRing *ring) {
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t key_event_offset(uint64_t time_ns, uint64_t start_ns, uint64_t span_ns, uint64_t count) {
+    if (time_ns <= start_ns || span_ns == 0) return 0;
+    if (time_ns - start_ns >= span_ns) return count;
+
+    // 128-bit product: span_ns times count can exceed 64 bits on long stalls
+    return (uint64_t)((unsigned __int128)(time_ns - start_ns) * count / span_ns);
+}
@@ -0,0 +1,39 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "chip8.h"
+
+// Key events from the thread that polls the host to the emulator thread,
+// through a single-producer single-consumer ring. Each event carries the time
+// it was polled, so the emulator can apply it at the matching instruction
+// boundary instead of whenever it next happens to look; a press and release
+// that both land inside one frame are two events, not a lost tap.
+
+struct KeyEvent {
+    uint64_t time_ns; // monotonic_ns() when polled
+    uint8_t key;      // 0x0-0xF
+    bool pressed;
+};
+
+#define INPUT_RING_SIZE 256 // Power of two
+
+struct InputRing {
+    _Alignas(64) uint32_t head; // Next slot to write, owned by the producer
+    _Alignas(64) uint32_t tail; // Next slot to read, owned by the consumer
+    struct KeyEvent events[INPUT_RING_SIZE];
+};
+
+void initialise_input_ring(struct InputRing *ring);
+
+// Producer. Returns false (dropping the event) if the ring is full.
+bool push_key_event(struct InputRing *ring, const struct KeyEvent *event);
+
+// Consumer: the oldest unread event, or NULL; pop_key_event() then consumes it
+const struct KeyEvent *peek_key_event(struct InputRing *ring);
+void pop_key_event(struct InputRing *ring);
+
+// Instructions into a batch spanning [start_ns, start_ns + span_ns) and
+// `count` instructions at which an event polled at `time_ns` takes effect
+uint64_t key_event_offset(uint64_t time_ns, uint64_t start_ns, uint64_t span_ns, uint64_t count);
+
+#endif
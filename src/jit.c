@@ -0,0 +1,543 @@
+#include "jit.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+#define JIT_CODE_SIZE (1 << 20)
+#define JIT_BLOCK_BYTES 8192 // Worst-case native size of one block, with headroom
+
+typedef void (*BlockCode)(struct Chip8 *state);
+
+struct Block {
+    BlockCode code;
+    uint16_t length; // CHIP-8 instructions in the block
+};
+
+struct Jit {
+    uint8_t *code;
+    size_t code_used;
+    uint8_t written_bytes; // store_bytes of a chained block whose store hit translated code
+
+    struct Block blocks[MEMORY_SIZE]; // Keyed by block start PC
+};
+
+#ifdef JIT_X86_64
+
+//
+// x86-64 code emission. Translated blocks are called as void block(struct Chip8 *)
+// and keep the machine pointer in rbx; every operand is [rbx + disp32].
+//
+
+#define REGISTER_OFFSET(r) ((int32_t)(offsetof(struct Chip8, registers) + (r)))
+#define PC_OFFSET ((int32_t)offsetof(struct Chip8, pc))
+#define INDEX_OFFSET ((int32_t)offsetof(struct Chip8, index))
+#define CYCLES_OFFSET ((int32_t)offsetof(struct Chip8, cycles))
+#define SP_OFFSET ((int32_t)offsetof(struct Chip8, sp))
+#define STACK_OFFSET ((int32_t)offsetof(struct Chip8, stack))
+#define RUN_STOP_OFFSET ((int32_t)offsetof(struct Chip8, run_stop))
+#define CODE_WRITTEN_OFFSET ((int32_t)offsetof(struct Chip8, code_written))
+
+#define PROLOGUE_BYTES 4 // Chained blocks jump in past it, rbx already set
+
+_Static_assert(sizeof(struct Block) == 16, "chaining indexes blocks[] with a shift by 4");
+
+#define AL 0
+#define CL 1
+
+struct Emitter {
+    uint8_t *p;
+};
+
+static void emit8(struct Emitter *e, uint8_t byte) {
+    *e->p++ = byte;
+}
+
+static void emit16(struct Emitter *e, uint16_t value) {
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+static void emit32(struct Emitter *e, uint32_t value) {
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+static void emit64(struct Emitter *e, uint64_t value) {
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+// ModRM for [rbx + disp32] with `reg` in the reg field
+static void emit_rbx_operand(struct Emitter *e, uint8_t reg, int32_t disp) {
+    emit8(e, 0x80 | (reg << 3) | 0x3);
+    emit32(e, (uint32_t)disp);
+}
+
+// ModRM and SIB for [rbx + rax * 2 + stack] with `reg` in the reg field
+static void emit_stack_operand(struct Emitter *e, uint8_t reg) {
+    emit8(e, 0x84 | (reg << 3));
+    emit8(e, 0x43);
+    emit32(e, (uint32_t)STACK_OFFSET);
+}
+
+static void emit_prologue(struct Emitter *e) {
+    emit8(e, 0x53);                                  // push rbx
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xFB);  // mov rbx, rdi
+}
+
+static void emit_epilogue(struct Emitter *e) {
+    emit8(e, 0x5B);  // pop rbx
+    emit8(e, 0xC3);  // ret
+}
+
+// Forward rel8 jump to a label bound later by bind_label()
+static uint8_t *emit_jump8(struct Emitter *e, uint8_t opcode) {
+    emit8(e, opcode);
+    emit8(e, 0);
+    return e->p - 1;
+}
+
+static void bind_label(struct Emitter *e, uint8_t *rel8) {
+    *rel8 = (uint8_t)(e->p - (rel8 + 1));
+}
+
+// Ends a block by jumping straight into the block at the new PC, if it is
+// translated and fits before run_stop; otherwise returns to step_block().
+// A store that hit translated code always returns, leaving its byte count in
+// jit->written_bytes so step_block() drops only the blocks it overlapped.
+static void emit_chain(struct Emitter *e, struct Jit *jit, uint8_t store_bytes) {
+    uint8_t *written = NULL;
+
+    if (store_bytes > 0) {
+        emit8(e, 0x80);  // cmp byte [code_written], 0
+        emit_rbx_operand(e, 7, CODE_WRITTEN_OFFSET);
+        emit8(e, 0);
+        written = emit_jump8(e, 0x75);  // jne written
+    }
+
+    emit8(e, 0x0F); emit8(e, 0xB7);  // movzx eax, word [pc]
+    emit_rbx_operand(e, AL, PC_OFFSET);
+    emit8(e, 0x3D);  // cmp eax, MEMORY_SIZE - 2
+    emit32(e, MEMORY_SIZE - 2);
+    uint8_t *past_end = emit_jump8(e, 0x77);  // ja exit
+
+    emit8(e, 0xC1); emit8(e, 0xE0); emit8(e, 4);  // shl eax, 4
+    emit8(e, 0x48); emit8(e, 0xB9);  // mov rcx, imm64
+    emit64(e, (uint64_t)(uintptr_t)jit->blocks);
+    emit8(e, 0x48); emit8(e, 0x01); emit8(e, 0xC8);  // add rax, rcx
+    emit8(e, 0x48); emit8(e, 0x8B); emit8(e, 0x08);  // mov rcx, [rax] (code)
+    emit8(e, 0x48); emit8(e, 0x85); emit8(e, 0xC9);  // test rcx, rcx
+    uint8_t *untranslated = emit_jump8(e, 0x74);  // jz exit
+
+    emit8(e, 0x0F); emit8(e, 0xB7); emit8(e, 0x50);  // movzx edx, word [rax + length]
+    emit8(e, offsetof(struct Block, length));
+    emit8(e, 0x48); emit8(e, 0x03);  // add rdx, [cycles]
+    emit_rbx_operand(e, 2, CYCLES_OFFSET);
+    emit8(e, 0x48); emit8(e, 0x3B);  // cmp rdx, [run_stop]
+    emit_rbx_operand(e, 2, RUN_STOP_OFFSET);
+    uint8_t *too_long = emit_jump8(e, 0x77);  // ja exit
+
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xC1); emit8(e, PROLOGUE_BYTES);  // add rcx, PROLOGUE_BYTES
+    emit8(e, 0xFF); emit8(e, 0xE1);  // jmp rcx
+
+    bind_label(e, past_end);
+    bind_label(e, untranslated);
+    bind_label(e, too_long);
+    emit_epilogue(e);
+
+    if (written != NULL) {
+        bind_label(e, written);
+        emit8(e, 0x48); emit8(e, 0xB8);  // mov rax, imm64
+        emit64(e, (uint64_t)(uintptr_t)&jit->written_bytes);
+        emit8(e, 0xC6); emit8(e, 0x00); emit8(e, store_bytes);  // mov byte [rax], store_bytes
+        emit_epilogue(e);
+    }
+}
+
+static void emit_store_pc(struct Emitter *e, uint16_t pc) {
+    emit8(e, 0x66); emit8(e, 0xC7);  // mov word [rbx + pc], imm16
+    emit_rbx_operand(e, 0, PC_OFFSET);
+    emit16(e, pc);
+}
+
+// Calls ins->execute(state, ins)
+static void emit_call(struct Emitter *e, const struct Instruction *ins) {
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xDF);  // mov rdi, rbx
+    emit8(e, 0x48); emit8(e, 0xBE);  // mov rsi, imm64
+    emit64(e, (uint64_t)(uintptr_t)ins);
+    emit8(e, 0x48); emit8(e, 0xB8);  // mov rax, imm64
+    emit64(e, (uint64_t)(uintptr_t)ins->execute);
+    emit8(e, 0xFF); emit8(e, 0xD0);  // call rax
+}
+
+static void emit_add_cycles(struct Emitter *e, uint32_t count) {
+    emit8(e, 0x48); emit8(e, 0x81);  // add qword [rbx + cycles], imm32
+    emit_rbx_operand(e, 0, CYCLES_OFFSET);
+    emit32(e, count);
+}
+
+// Skip: PC = addr + 2, then + 2 more unless the preceding compare sets `jcc_no_skip`
+static void emit_skip(struct Emitter *e, uint16_t addr, uint8_t jcc_no_skip) {
+    emit_store_pc(e, addr + 2);
+    emit8(e, jcc_no_skip);
+    emit8(e, 9);  // Length of the store below
+    emit_store_pc(e, addr + 4);
+}
+
+#define JE 0x74
+#define JNE 0x75
+
+// Calls and returns, with the stack fault cases left to the handler
+static void emit_call_return(struct Emitter *e, const struct Instruction *ins, uint16_t addr) {
+    uint8_t *fault;
+
+    if (ins->execute == &OP_2NNN) {
+        emit8(e, 0x80);  // cmp byte [sp], 16
+        emit_rbx_operand(e, 7, SP_OFFSET);
+        emit8(e, 16);
+        fault = emit_jump8(e, 0x73);  // jae fault
+        emit8(e, 0x0F); emit8(e, 0xB6);  // movzx eax, byte [sp]
+        emit_rbx_operand(e, AL, SP_OFFSET);
+        emit8(e, 0x66); emit8(e, 0xC7);  // mov word [stack + sp * 2], addr + 2
+        emit_stack_operand(e, 0);
+        emit16(e, addr + 2);
+        emit8(e, 0xFE);  // inc byte [sp]
+        emit_rbx_operand(e, 0, SP_OFFSET);
+        emit_store_pc(e, ins->nnn);
+    } else {
+        emit8(e, 0x0F); emit8(e, 0xB6);  // movzx eax, byte [sp]
+        emit_rbx_operand(e, AL, SP_OFFSET);
+        emit8(e, 0x84); emit8(e, 0xC0);  // test al, al
+        fault = emit_jump8(e, 0x74);  // jz fault
+        emit8(e, 0xFE); emit8(e, 0xC8);  // dec al
+        emit8(e, 0x88);  // mov [sp], al
+        emit_rbx_operand(e, AL, SP_OFFSET);
+        emit8(e, 0x83); emit8(e, 0xE0); emit8(e, 0x0F);  // and eax, 0xF
+        emit8(e, 0x0F); emit8(e, 0xB7);  // movzx ecx, word [stack + sp * 2]
+        emit_stack_operand(e, CL);
+        emit8(e, 0x66); emit8(e, 0x89);  // mov [pc], cx
+        emit_rbx_operand(e, CL, PC_OFFSET);
+    }
+
+    uint8_t *done = emit_jump8(e, 0xEB);  // jmp done
+
+    bind_label(e, fault);
+    emit_store_pc(e, addr + 2);
+    emit_call(e, ins);
+    bind_label(e, done);
+}
+
+// Translates register ops, jumps, calls and skips directly; returns false for anything else
+static bool emit_inline(struct Emitter *e, const struct Instruction *ins, uint16_t addr) {
+    Handler h = ins->execute;
+
+    if (h == &OP_1NNN && !may_idle(ins, addr)) {
+        emit_store_pc(e, ins->nnn);
+    } else if (h == &OP_2NNN || h == &OP_00EE) {
+        emit_call_return(e, ins, addr);
+    } else if (h == &OP_3XKK || h == &OP_4XKK) {
+        emit8(e, 0x80);  // cmp byte [Vx], kk
+        emit_rbx_operand(e, 7, REGISTER_OFFSET(ins->x));
+        emit8(e, ins->kk);
+        emit_skip(e, addr, h == &OP_3XKK ? JNE : JE);
+    } else if (h == &OP_5XY0 || h == &OP_9XY0) {
+        emit8(e, 0x8A);  // mov al, [Vx]
+        emit_rbx_operand(e, AL, REGISTER_OFFSET(ins->x));
+        emit8(e, 0x3A);  // cmp al, [Vy]
+        emit_rbx_operand(e, AL, REGISTER_OFFSET(ins->y));
+        emit_skip(e, addr, h == &OP_5XY0 ? JNE : JE);
+    } else if (h == &OP_6XKK) {
+        emit8(e, 0xC6);  // mov byte [Vx], kk
+        emit_rbx_operand(e, 0, REGISTER_OFFSET(ins->x));
+        emit8(e, ins->kk);
+    } else if (h == &OP_7XKK) {
+        emit8(e, 0x80);  // add byte [Vx], kk
+        emit_rbx_operand(e, 0, REGISTER_OFFSET(ins->x));
+        emit8(e, ins->kk);
+    } else if (h == &OP_8XY0 || h == &OP_8XY1 || h == &OP_8XY2 || h == &OP_8XY3) {
+        emit8(e, 0x8A);  // mov al, [Vy]
+        emit_rbx_operand(e, AL, REGISTER_OFFSET(ins->y));
+
+        if (h == &OP_8XY0)      emit8(e, 0x88);  // mov [Vx], al
+        else if (h == &OP_8XY1) emit8(e, 0x08);  // or  [Vx], al
+        else if (h == &OP_8XY2) emit8(e, 0x20);  // and [Vx], al
+        else                    emit8(e, 0x30);  // xor [Vx], al
+        emit_rbx_operand(e, AL, REGISTER_OFFSET(ins->x));
+    } else if (h == &OP_8XY4) {
+        emit8(e, 0x8A);  // mov al, [Vx]
+        emit_rbx_operand(e, AL, REGISTER_OFFSET(ins->x));
+        emit8(e, 0x02);  // add al, [Vy]
+        emit_rbx_operand(e, AL, REGISTER_OFFSET(ins->y));
+        emit8(e, 0x0F); emit8(e, 0x92); emit8(e, 0xC1);  // setc cl
+
+        // VF first, then Vx, so 8FY4 keeps the sum like the interpreter does
+        emit8(e, 0x88);  // mov [VF], cl
+        emit_rbx_operand(e, CL, REGISTER_OFFSET(FLAG_REGISTER));
+        emit8(e, 0x88);  // mov [Vx], al
+        emit_rbx_operand(e, AL, REGISTER_OFFSET(ins->x));
+    } else if (h == &OP_ANNN) {
+        emit8(e, 0x66); emit8(e, 0xC7);  // mov word [I], nnn
+        emit_rbx_operand(e, 0, INDEX_OFFSET);
+        emit16(e, ins->nnn);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+// Control flow, skips, key waits and memory stores end a block
+static bool ends_block(Handler h) {
+    return h == &OP_1NNN || h == &OP_2NNN || h == &OP_00EE || h == &OP_BNNN ||
+           h == &OP_3XKK || h == &OP_4XKK || h == &OP_5XY0 || h == &OP_9XY0 ||
+           h == &OP_EX9E || h == &OP_EXA1 || h == &OP_FX0A ||
+           h == &OP_FX33 || h == &OP_FX55;
+}
+
+static void compile_block(struct Jit *jit, struct Chip8 *state, uint16_t start) {
+    if (JIT_CODE_SIZE - jit->code_used < JIT_BLOCK_BYTES) flush_jit(jit);
+
+    struct Emitter e = { jit->code + jit->code_used };
+    uint8_t *entry = e.p;
+
+    uint16_t addr = start;
+    uint16_t length = 0;
+    uint8_t store_bytes = 0; // Bytes written from I by a closing FX33/FX55, 0 if none
+    uint16_t pending_cycles = 0; // Instructions not yet added to state->cycles
+    bool ended = false;
+
+    emit_prologue(&e);
+
+    while (!ended && length < JIT_MAX_BLOCK && addr <= MEMORY_SIZE - 2) {
+        const struct Instruction *ins = decode_at(state, addr);
+
+        if (reads_cycles(ins, addr) && pending_cycles > 0) {
+            emit_add_cycles(&e, pending_cycles);
+            pending_cycles = 0;
+        }
+
+        if (!emit_inline(&e, ins, addr)) {
+            // Fall back to the interpreter's handler, with PC as cycle() would leave it
+            emit_store_pc(&e, addr + 2);
+            emit_call(&e, ins);
+        }
+
+        ended = ends_block(ins->execute);
+
+        if (ins->execute == &OP_FX33) store_bytes = 3;
+        if (ins->execute == &OP_FX55) store_bytes = ins->x + 1;
+
+        pending_cycles++;
+        length++;
+        addr += 2;
+    }
+
+    if (!ended) emit_store_pc(&e, addr);
+    emit_add_cycles(&e, pending_cycles);
+    emit_chain(&e, jit, store_bytes);
+
+    jit->code_used += e.p - entry;
+    jit->blocks[start].code = (BlockCode)(void *)entry;
+    jit->blocks[start].length = length;
+}
+
+// Drops every block containing a byte in [first_byte, last_byte], which must not wrap
+static void invalidate_span(struct Jit *jit, int first_byte, int last_byte) {
+    int first = first_byte - 2 * JIT_MAX_BLOCK;
+
+    if (first < 0) first = 0;
+
+    for (int start = first; start <= last_byte; start++) {
+        struct Block *block = &jit->blocks[start];
+
+        if (block->code != NULL && start + 2 * block->length > first_byte) block->code = NULL;
+    }
+}
+
+// Drops every block containing a byte in [addr, addr + count), wrapping past
+// 0xFFF like write_memory() does
+static void invalidate_range(struct Jit *jit, uint16_t addr, uint16_t count) {
+    int last = (int)addr + count - 1;
+
+    invalidate_span(jit, addr, last < MEMORY_SIZE ? last : MEMORY_SIZE - 1);
+
+    if (last >= MEMORY_SIZE) invalidate_span(jit, 0, last & (MEMORY_SIZE - 1));
+}
+
+bool jit_supported() {
+    return true;
+}
+
+struct Jit *create_jit() {
+    struct Jit *jit = (struct Jit *)calloc(1, sizeof(struct Jit));
+
+    if (jit == NULL) error("Failed to allocate JIT", true);
+
+    void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED) {
+        // Hosts that forbid writable+executable pages get the interpreter
+        error("Failed to map JIT code cache, using interpreter", false);
+        code = NULL;
+    }
+
+    jit->code = (uint8_t *)code;
+    return jit;
+}
+
+void destroy_jit(struct Jit *jit) {
+    if (jit->code != NULL) munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+// Runs translated blocks, chained for as long as they fit before run_stop, or
+// one interpreted instruction; returns the instructions run
+static uint64_t step_block(struct Jit *jit, struct Chip8 *state, uint64_t remaining) {
+    // An interpreted store hit translated code; start over
+    if (state->code_written) {
+        flush_jit(jit);
+        state->code_written = false;
+    }
+
+    uint16_t pc = state->pc;
+
+    if (jit->code == NULL || pc > MEMORY_SIZE - 2) {
+        cycle(state);
+        return 1;
+    }
+
+    struct Block *block = &jit->blocks[pc];
+
+    if (block->code == NULL) compile_block(jit, state, pc);
+
+    if (block->length > remaining) {
+        cycle(state);
+        return 1;
+    }
+
+    uint64_t start = state->cycles;
+
+    jit->written_bytes = 0;
+    block->code(state);
+
+    // A block's closing store hit translated code: drop just the blocks it overlapped
+    if (state->code_written) {
+        if (jit->written_bytes > 0) invalidate_range(jit, state->index, jit->written_bytes);
+        else flush_jit(jit);
+
+        state->code_written = false;
+    }
+
+    return state->cycles - start;
+}
+
+#else
+
+bool jit_supported() {
+    return false;
+}
+
+struct Jit *create_jit() {
+    struct Jit *jit = (struct Jit *)calloc(1, sizeof(struct Jit));
+
+    if (jit == NULL) error("Failed to allocate JIT", true);
+
+    return jit;
+}
+
+void destroy_jit(struct Jit *jit) {
+    free(jit);
+}
+
+static uint64_t step_block(struct Jit *jit, struct Chip8 *state, uint64_t remaining) {
+    (void)jit;
+    (void)remaining;
+
+    cycle(state);
+    return 1;
+}
+
+#endif
+
+void flush_jit(struct Jit *jit) {
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    jit->code_used = 0;
+}
+
+// Instructions left before `end` or the next scheduled event, whichever is sooner
+static uint64_t run_limit(struct Chip8 *state, uint64_t end) {
+    update_run_stop(state, end);
+
+    return state->run_stop > state->cycles ? state->run_stop - state->cycles : 0;
+}
+
+uint64_t run_jit(struct Jit *jit, struct Chip8 *state, uint64_t budget) {
+    uint64_t end = state->cycles + budget;
+
+    while (state->cycles < end) {
+        uint64_t remaining = run_limit(state, end);
+
+        // Events scheduled inside a block are dispatched when it returns, still carrying their exact cycle
+        if (remaining > 0) step_block(jit, state, remaining);
+        dispatch_events(state);
+    }
+
+    return budget;
+}
+
+// Name of the first piece of architectural state that differs, or NULL
+static const char *diff_state(const struct Chip8 *a, const struct Chip8 *b) {
+    if (memcmp(a->registers, b->registers, sizeof(a->registers)) != 0) return "registers";
+    if (a->pc != b->pc) return "pc";
+    if (a->index != b->index) return "index";
+    if (a->sp != b->sp) return "sp";
+    if (memcmp(a->stack, b->stack, sizeof(a->stack)) != 0) return "stack";
+    if (a->cycles != b->cycles) return "cycles";
+    if (a->delay_expiry != b->delay_expiry) return "delay timer";
+    if (a->sound_expiry != b->sound_expiry) return "sound timer";
+    if (a->faults != b->faults || memcmp(a->fault_pc, b->fault_pc, sizeof(a->fault_pc)) != 0) return "faults";
+    if (memcmp(a->memory, b->memory, MEMORY_SIZE) != 0) return "memory";
+    if (memcmp(a->display, b->display, sizeof(a->display)) != 0) return "display";
+
+    return NULL;
+}
+
+uint64_t run_jit_lockstep(struct Jit *jit, struct Chip8 *state, struct Chip8 *shadow, uint64_t budget) {
+    uint64_t end = state->cycles + budget;
+    uint64_t mismatches = 0;
+
+    copy_machine(shadow, state); // Drops the handler: events are reported once, by `state`
+
+    while (state->cycles < end) {
+        uint16_t pc = state->pc;
+        uint64_t remaining = run_limit(state, end);
+
+        // Same run_stop, so the shadow makes the same idle skips
+        shadow->run_stop = state->run_stop;
+
+        uint64_t length = remaining > 0 ? step_block(jit, state, remaining) : 0;
+
+        while (shadow->cycles < state->cycles) cycle(shadow);
+
+        dispatch_events(state);
+        dispatch_events(shadow);
+
+        const char *diff = diff_state(state, shadow);
+
+        if (diff != NULL) {
+            fprintf(stderr, "JIT mismatch: block at %03X (%llu instructions) differs in %s\n",
+                    pc, (unsigned long long)length, diff);
+
+            // Resync so one bad block is reported once, not on every block after it
+            mismatches++;
+            copy_machine(shadow, state);
+        }
+    }
+
+    return mismatches;
+}
@@ -0,0 +1,32 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "chip8.h"
+
+// Optional x86-64 dynamic recompiler. Each machine gets its own Jit, which
+// translates basic blocks into native code and caches them by PC. A block
+// jumps straight into the next translated one while it fits before run_stop,
+// so the dispatcher only runs for events, stores into code and untranslated
+// PCs. Anything the JIT can't run (unsupported host, block longer than the
+// remaining budget, PC at the end of memory) is stepped through cycle() instead.
+
+#define JIT_MAX_BLOCK 64 // Instructions per translated block, here and in chip8-aot
+
+struct Jit;
+
+bool jit_supported();
+
+struct Jit *create_jit();
+void destroy_jit(struct Jit *jit);
+void flush_jit(struct Jit *jit); // Drop every translated block
+
+// Runs exactly `budget` instructions, dispatching core events between blocks;
+// returns the number executed
+uint64_t run_jit(struct Jit *jit, struct Chip8 *state, uint64_t budget);
+
+// As run_jit(), but steps `shadow` through the interpreter alongside and diffs
+// register and display state after every block. `shadow` is synced from `state`
+// first. Returns the number of blocks that diverged (each is reported on stderr).
+uint64_t run_jit_lockstep(struct Jit *jit, struct Chip8 *state, struct Chip8 *shadow, uint64_t budget);
+
+#endif
@@ -0,0 +1,175 @@
+#include "journal.h"
+#include "savestate.h"
+
+#include <string.h>
+
+#define INITIAL_CAPACITY 256
+
+struct Journal *create_journal(uint64_t seed, uint32_t cycles_per_frame, const uint8_t *rom, size_t rom_size) {
+    struct Journal *journal = (struct Journal *)calloc(1, sizeof(struct Journal));
+
+    if (journal == NULL) error("Failed to allocate journal", true);
+
+    journal->seed = seed;
+    journal->cycles_per_frame = cycles_per_frame;
+    journal->rom_crc32c = crc32c(rom, rom_size);
+
+    return journal;
+}
+
+void destroy_journal(struct Journal *journal) {
+    free(journal->entries);
+    free(journal);
+}
+
+static void append_entry(struct Journal *journal, uint64_t cycle, uint16_t keys) {
+    if (journal->count == journal->capacity) {
+        journal->capacity = journal->capacity ? journal->capacity * 2 : INITIAL_CAPACITY;
+        journal->entries = (struct JournalEntry *)realloc(journal->entries, journal->capacity * sizeof(struct JournalEntry));
+
+        if (journal->entries == NULL) error("Failed to grow journal", true);
+    }
+
+    journal->entries[journal->count].cycle = cycle;
+    journal->entries[journal->count].keys = keys;
+    journal->count++;
+}
+
+void journal_record(struct Journal *journal, const struct Chip8 *state) {
+    uint16_t keys = keypad_mask(state);
+
+    if (keys != journal->last_keys) {
+        append_entry(journal, state->cycles, keys);
+        journal->last_keys = keys;
+    }
+
+    journal->end_cycle = state->cycles;
+}
+
+static void write_varint(FILE *fp, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        fputc(byte | (value ? 0x80 : 0), fp);
+    } while (value);
+}
+
+static bool read_varint(FILE *fp, uint64_t *value) {
+    *value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(fp);
+
+        if (byte == EOF) return false;
+
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+
+    return false;
+}
+
+bool save_journal(const struct Journal *journal, const char *filename) {
+    FILE *fp;
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+        error("Failed to open journal file", false);
+        return false;
+    }
+
+    struct JournalHeader header = {
+        JOURNAL_MAGIC, JOURNAL_VERSION, 0, journal->cycles_per_frame, journal->rom_crc32c,
+        journal->seed, journal->end_cycle, journal->count,
+    };
+
+    fwrite(&header, sizeof(header), 1, fp);
+
+    uint64_t previous = 0;
+
+    for (size_t i = 0; i < journal->count; i++) {
+        write_varint(fp, journal->entries[i].cycle - previous);
+        fputc(journal->entries[i].keys & 0xFF, fp);
+        fputc(journal->entries[i].keys >> 8, fp);
+
+        previous = journal->entries[i].cycle;
+    }
+
+    bool ok = !ferror(fp);
+
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) error("Failed to write journal file", false);
+
+    return ok;
+}
+
+struct Journal *load_journal(const char *filename) {
+    FILE *fp;
+    struct JournalHeader header;
+
+    if ((fp = fopen(filename, "rb")) == NULL) {
+        error("Failed to open journal file", false);
+        return NULL;
+    }
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != JOURNAL_MAGIC || header.version != JOURNAL_VERSION ||
+        header.cycles_per_frame == 0) {
+        fclose(fp);
+        error("Not a journal file", false);
+        return NULL;
+    }
+
+    struct Journal *journal = (struct Journal *)calloc(1, sizeof(struct Journal));
+
+    if (journal == NULL) error("Failed to allocate journal", true);
+
+    journal->seed = header.seed;
+    journal->cycles_per_frame = header.cycles_per_frame;
+    journal->rom_crc32c = header.rom_crc32c;
+    journal->end_cycle = header.end_cycle;
+
+    uint64_t cycle = 0;
+
+    for (uint64_t i = 0; i < header.entry_count; i++) {
+        uint64_t delta;
+        int lo;
+        int hi;
+
+        if (!read_varint(fp, &delta) || (lo = fgetc(fp)) == EOF || (hi = fgetc(fp)) == EOF) {
+            fclose(fp);
+            destroy_journal(journal);
+            error("Journal file is truncated", false);
+            return NULL;
+        }
+
+        cycle += delta;
+        append_entry(journal, cycle, (uint16_t)(lo | hi << 8));
+    }
+
+    fclose(fp);
+    return journal;
+}
+
+bool replay_journal(const struct Journal *journal, struct Chip8 *state, const uint8_t *rom, size_t rom_size) {
+    if (crc32c(rom, rom_size) != journal->rom_crc32c) {
+        error("ROM does not match the journal", false);
+        return false;
+    }
+
+    initialise(state);
+    seed_random(state, journal->seed);
+    state->cycles_per_frame = journal->cycles_per_frame;
+    load_rom_data(state, rom, rom_size);
+
+    // Run straight to each key change; run_cycles() stops exactly on it
+    for (size_t i = 0; i < journal->count; i++) {
+        const struct JournalEntry *entry = &journal->entries[i];
+
+        if (entry->cycle > state->cycles) run_cycles(state, entry->cycle - state->cycles);
+
+        set_keypad_mask(state, entry->keys);
+    }
+
+    if (journal->end_cycle > state->cycles) run_cycles(state, journal->end_cycle - state->cycles);
+
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "chip8.h"
+
+// Input journal for deterministic replay. A run is fully determined by the
+// ROM, the RNG seed, cycles_per_frame and the instruction counts at which the
+// keypad changed, so that is all a journal stores. Replaying applies each key
+// change at its recorded cycle and reproduces the run bit-for-bit, uncapped.
+//
+// File layout: a JournalHeader, then per entry a LEB128 varint of the cycle
+// delta from the previous entry and the 16-bit key mask (little-endian).
+
+#define JOURNAL_MAGIC 0x4A493843 // "C8IJ"
+#define JOURNAL_VERSION 1
+
+struct JournalHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t cycles_per_frame;
+    uint32_t rom_crc32c;
+    uint64_t seed;
+    uint64_t end_cycle;
+    uint64_t entry_count;
+};
+
+struct JournalEntry {
+    uint64_t cycle;
+    uint16_t keys; // keypad_mask() from this cycle on
+};
+
+struct Journal {
+    uint64_t seed;
+    uint32_t cycles_per_frame;
+    uint32_t rom_crc32c;
+    uint64_t end_cycle; // Instructions in the recorded run
+
+    struct JournalEntry *entries;
+    size_t count;
+    size_t capacity;
+
+    uint16_t last_keys; // Recording: mask at the last entry
+};
+
+struct Journal *create_journal(uint64_t seed, uint32_t cycles_per_frame, const uint8_t *rom, size_t rom_size);
+void destroy_journal(struct Journal *journal);
+
+// Recording: call whenever the keypad may have changed, before running more instructions
+void journal_record(struct Journal *journal, const struct Chip8 *state);
+
+bool save_journal(const struct Journal *journal, const char *filename);
+struct Journal *load_journal(const char *filename); // NULL if missing or malformed
+
+// Resets `state`, loads the ROM (which must match the recorded one), then
+// runs to end_cycle applying every key change at its cycle
+bool replay_journal(const struct Journal *journal, struct Chip8 *state, const uint8_t *rom, size_t rom_size);
+
+#endif
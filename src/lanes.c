@@ -0,0 +1,526 @@
+#include "lanes.h"
+
+#include <pthread.h>
+#include <string.h>
+
+struct LaneGroup {
+    uint8_t registers[16][LANE_GROUP];
+    uint16_t pc[LANE_GROUP];
+    uint16_t index[LANE_GROUP];
+    uint64_t cycles[LANE_GROUP];
+    uint64_t end[LANE_GROUP]; // A lane is live while cycles < end; padding lanes never are
+
+    struct Chip8 *machines[LANE_GROUP]; // NULL for padding lanes
+    bool same_memory; // Every lane reads the same SharedMemory, so one decode serves all
+
+    // Converged: every live lane is at `converged_pc`, so control flow is tracked
+    // once here and the per-lane pc and cycles arrays lag until flushed
+    bool converged;
+    uint16_t converged_pc;
+    uint64_t steps;  // Run since converging, not yet added to cycles[]
+    uint64_t budget; // Instructions every live lane can still run
+    uint8_t live[LANE_GROUP]; // 0xFF for the lanes that converged
+    int live_count;
+    int first; // A live lane, whose machine decodes for the group
+
+    // Lane-instructions since the group last checked whether lockstep pays
+    uint64_t window_vector;
+    uint64_t window_scalar;
+};
+
+#define LANE_SCALAR_RUN 64 // Most instructions one lane runs through cycle() per step
+
+// Interleaving lanes through cycle() costs cache locality, so a group whose
+// recent window was under three quarters vector lets each lane run alone for a while
+#define LANE_WINDOW (LANE_GROUP * 512)
+#define LANE_SOLO_RUN 16384
+
+// What the vector kernel does with an opcode; LANE_SCALAR goes through cycle()
+enum LaneKind {
+    LANE_SCALAR,
+    LANE_1NNN,
+    LANE_3XKK,
+    LANE_4XKK,
+    LANE_5XY0,
+    LANE_9XY0,
+    LANE_6XKK,
+    LANE_7XKK,
+    LANE_8XY0,
+    LANE_8XY1,
+    LANE_8XY2,
+    LANE_8XY3,
+    LANE_8XY4,
+    LANE_8XY5,
+    LANE_8XY6,
+    LANE_8XY7,
+    LANE_8XYE,
+    LANE_ANNN,
+};
+
+static uint8_t lane_kinds[0x10000];
+static pthread_once_t lane_kinds_once = PTHREAD_ONCE_INIT;
+
+static void build_lane_kinds() {
+    static const struct {
+        Handler handler;
+        enum LaneKind kind;
+    } vectorised[] = {
+        { &OP_1NNN, LANE_1NNN }, { &OP_3XKK, LANE_3XKK }, { &OP_4XKK, LANE_4XKK },
+        { &OP_5XY0, LANE_5XY0 }, { &OP_9XY0, LANE_9XY0 }, { &OP_6XKK, LANE_6XKK },
+        { &OP_7XKK, LANE_7XKK }, { &OP_8XY0, LANE_8XY0 }, { &OP_8XY1, LANE_8XY1 },
+        { &OP_8XY2, LANE_8XY2 }, { &OP_8XY3, LANE_8XY3 }, { &OP_8XY4, LANE_8XY4 },
+        { &OP_8XY5, LANE_8XY5 }, { &OP_8XY6, LANE_8XY6 }, { &OP_8XY7, LANE_8XY7 },
+        { &OP_8XYE, LANE_8XYE }, { &OP_ANNN, LANE_ANNN },
+    };
+
+    build_decode_table();
+
+    for (int opcode = 0; opcode < 0x10000; opcode++) {
+        lane_kinds[opcode] = LANE_SCALAR;
+
+        for (size_t i = 0; i < sizeof(vectorised) / sizeof(vectorised[0]); i++) {
+            if (decode_table[opcode].execute == vectorised[i].handler) lane_kinds[opcode] = vectorised[i].kind;
+        }
+    }
+}
+
+// Lane loops below are written element-wise over a whole group so the
+// compiler turns each into a few vector instructions. `mask` is 0x00 or 0xFF
+// per lane and selects bitwise, since a conditional store would not vectorise.
+// Rows are copied to locals first, since X, Y and VF may be the same register.
+#define LANES(l) for (int l = 0; l < LANE_GROUP; l++)
+
+static inline __attribute__((always_inline))
+void blend(uint8_t *row, const uint8_t *value, const uint8_t *mask) {
+    LANES(l) row[l] = (value[l] & mask[l]) | (row[l] & ~mask[l]);
+}
+
+// Data effects of register, skip and jump opcodes; skips fill `skip` and the
+// caller moves PC. Each writes VF before VX, as the handlers do, and re-reads
+// both rows after the VF write.
+static inline __attribute__((always_inline))
+void execute_vector(struct LaneGroup *g, const uint8_t *mask, enum LaneKind kind, const struct Instruction *ins,
+                    uint8_t *skip) {
+    uint8_t *vx = g->registers[ins->x];
+    uint8_t *vy = g->registers[ins->y];
+    uint8_t *vf = g->registers[FLAG_REGISTER];
+    uint8_t kk = ins->kk;
+    uint16_t nnn = ins->nnn;
+
+    uint8_t a[LANE_GROUP];
+    uint8_t b[LANE_GROUP];
+    uint8_t result[LANE_GROUP];
+
+    memcpy(a, vx, LANE_GROUP);
+    memcpy(b, vy, LANE_GROUP);
+
+    switch (kind) {
+        case LANE_3XKK: LANES(l) skip[l] = a[l] == kk; break;
+        case LANE_4XKK: LANES(l) skip[l] = a[l] != kk; break;
+        case LANE_5XY0: LANES(l) skip[l] = a[l] == b[l]; break;
+        case LANE_9XY0: LANES(l) skip[l] = a[l] != b[l]; break;
+
+        case LANE_6XKK: LANES(l) result[l] = kk; blend(vx, result, mask); break;
+        case LANE_7XKK: LANES(l) result[l] = a[l] + kk; blend(vx, result, mask); break;
+
+        case LANE_8XY0: blend(vx, b, mask); break;
+        case LANE_8XY1: LANES(l) result[l] = a[l] | b[l]; blend(vx, result, mask); break;
+        case LANE_8XY2: LANES(l) result[l] = a[l] & b[l]; blend(vx, result, mask); break;
+        case LANE_8XY3: LANES(l) result[l] = a[l] ^ b[l]; blend(vx, result, mask); break;
+
+        case LANE_8XY4: {
+            uint8_t carry[LANE_GROUP];
+
+            // The sum is taken before VF changes, then stored to VX after it
+            LANES(l) result[l] = a[l] + b[l];
+            LANES(l) carry[l] = result[l] < a[l];
+            blend(vf, carry, mask);
+            blend(vx, result, mask);
+            break;
+        }
+
+        case LANE_8XY5:
+        case LANE_8XY7:
+            if (kind == LANE_8XY5) LANES(l) result[l] = a[l] > b[l];
+            else                   LANES(l) result[l] = b[l] > a[l];
+            blend(vf, result, mask);
+
+            memcpy(a, vx, LANE_GROUP);
+            memcpy(b, vy, LANE_GROUP);
+
+            if (kind == LANE_8XY5) LANES(l) result[l] = a[l] - b[l];
+            else                   LANES(l) result[l] = b[l] - a[l];
+            blend(vx, result, mask);
+            break;
+
+        case LANE_8XY6:
+        case LANE_8XYE:
+            if (kind == LANE_8XY6) LANES(l) result[l] = a[l] & 0x1;
+            else                   LANES(l) result[l] = a[l] >> 7;
+            blend(vf, result, mask);
+
+            memcpy(a, vx, LANE_GROUP);
+
+            if (kind == LANE_8XY6) LANES(l) result[l] = a[l] >> 1;
+            else                   LANES(l) result[l] = a[l] << 1;
+            blend(vx, result, mask);
+            break;
+
+        case LANE_ANNN: LANES(l) g->index[l] = (nnn & (int8_t)mask[l]) | (g->index[l] & ~(int8_t)mask[l]); break;
+
+        case LANE_1NNN: break;
+        case LANE_SCALAR: break;
+    }
+}
+
+static bool is_skip(enum LaneKind kind) {
+    return kind == LANE_3XKK || kind == LANE_4XKK || kind == LANE_5XY0 || kind == LANE_9XY0;
+}
+
+// Vector kind of the instruction at addr, or LANE_SCALAR
+static enum LaneKind lane_kind(const struct Instruction *ins, uint16_t addr) {
+    enum LaneKind kind = (enum LaneKind)lane_kinds[ins - decode_table];
+
+    // Jumps that may be idle loops need OP_1NNN's skip, as in the JIT
+    if (kind == LANE_1NNN && may_idle(ins, addr)) return LANE_SCALAR;
+
+    return kind;
+}
+
+static const struct Instruction *fetch(struct Chip8 *state, uint16_t addr) {
+    const struct Instruction *ins = __atomic_load_n(&state->icache[addr], __ATOMIC_RELAXED);
+
+    return ins != NULL ? ins : decode_at(state, addr);
+}
+
+static void sync_to_machine(struct LaneGroup *g, int l) {
+    struct Chip8 *state = g->machines[l];
+
+    for (int r = 0; r < 16; r++) state->registers[r] = g->registers[r][l];
+    state->pc = g->pc[l];
+    state->index = g->index[l];
+    state->cycles = g->cycles[l];
+}
+
+static void sync_from_machine(struct LaneGroup *g, int l) {
+    struct Chip8 *state = g->machines[l];
+
+    for (int r = 0; r < 16; r++) g->registers[r][l] = state->registers[r];
+    g->pc[l] = state->pc;
+    g->index[l] = state->index;
+    g->cycles[l] = state->cycles;
+}
+
+static bool lanes_share_memory(const struct LaneGroup *g) {
+    for (int l = 1; l < LANE_GROUP && g->machines[l] != NULL; l++) {
+        if (g->machines[l]->shared != g->machines[0]->shared) return false;
+    }
+
+    return true;
+}
+
+// Writes the group's pc and step count back to every converged lane
+static void leave_converged(struct LaneGroup *g) {
+    uint8_t live[LANE_GROUP];
+
+    memcpy(live, g->live, LANE_GROUP);
+
+    LANES(l) g->pc[l] = (g->converged_pc & (int8_t)live[l]) | (g->pc[l] & ~(int8_t)live[l]);
+    LANES(l) g->cycles[l] += g->steps & (int8_t)live[l];
+
+    g->converged = false;
+}
+
+// True if every lane in `mask` decodes `ins` at addr
+static bool lanes_agree(struct LaneGroup *g, const uint8_t *mask, uint16_t addr, const struct Instruction *ins) {
+    for (int l = 0; l < LANE_GROUP; l++) {
+        if (mask[l] && fetch(g->machines[l], addr) != ins) return false;
+    }
+
+    return true;
+}
+
+// Runs vector instructions while every live lane stays at one PC. Skips that
+// split the lanes, scalar opcodes, lanes whose own memory holds a different
+// instruction and the end of the budget all leave the mode.
+static inline __attribute__((always_inline))
+void run_converged(struct Lanes *lanes, struct LaneGroup *g) {
+    struct Chip8 *state = g->machines[g->first];
+    uint8_t live[LANE_GROUP];
+    uint8_t skip[LANE_GROUP];
+
+    // A local copy, so the compiler knows register stores can't change it
+    memcpy(live, g->live, LANE_GROUP);
+    g->steps = 0;
+
+    while (g->steps < g->budget) {
+        uint16_t addr = g->converged_pc & (MEMORY_SIZE - 1);
+        const struct Instruction *ins = fetch(state, addr);
+        enum LaneKind kind = lane_kind(ins, addr);
+
+        if (kind == LANE_SCALAR) break;
+        if (!g->same_memory && !lanes_agree(g, live, addr, ins)) break;
+
+        execute_vector(g, live, kind, ins, skip);
+        g->steps++;
+
+        if (kind == LANE_1NNN) {
+            g->converged_pc = ins->nnn;
+        } else if (is_skip(kind)) {
+            uint8_t any = 0;
+            uint8_t all = 0xFF;
+
+            LANES(l) any |= skip[l] & live[l];
+            LANES(l) all &= skip[l] | ~live[l];
+
+            if (any != all) {
+                // Lanes part ways: each takes its own branch from here
+                g->steps--;
+                leave_converged(g);
+                LANES(l) g->pc[l] += (2 + 2 * (skip[l] & 1)) & live[l];
+                LANES(l) g->cycles[l] += live[l] & 1;
+
+                lanes->steps++;
+                lanes->vector_instructions += g->live_count;
+                g->window_vector += g->live_count;
+                return;
+            }
+
+            g->converged_pc += 2 + 2 * (all & 1);
+        } else {
+            g->converged_pc += 2;
+        }
+    }
+
+    lanes->steps += g->steps;
+    lanes->vector_instructions += g->steps * g->live_count;
+    g->window_vector += g->steps * g->live_count;
+    leave_converged(g);
+}
+
+// Runs one lane through cycle() for up to `limit` instructions, stopping early
+// (if `to_vector`) once its next instruction could go back to the vector
+// kernel. As run_cycles() would, it dispatches what's due and never idle-skips
+// past the lane's budget.
+static uint64_t run_scalar(struct LaneGroup *g, int l, uint64_t limit, bool to_vector) {
+    struct Chip8 *state = g->machines[l];
+    uint64_t count = 0;
+
+    sync_to_machine(g, l);
+
+    while (count < limit && state->cycles < g->end[l]) {
+        dispatch_events(state);
+        update_run_stop(state, g->end[l]);
+
+        while (state->cycles < state->run_stop && count < limit) {
+            cycle(state);
+            count++;
+
+            uint16_t addr = state->pc & (MEMORY_SIZE - 1);
+
+            if (to_vector && lane_kind(fetch(state, addr), addr) != LANE_SCALAR) goto done;
+        }
+    }
+
+done:
+    sync_from_machine(g, l);
+    return count;
+}
+
+// One step of one group: the lanes at the lowest PC run the instruction there.
+// Returns false once no lane has budget left.
+static inline __attribute__((always_inline))
+bool step_group_body(struct Lanes *lanes, struct LaneGroup *g) {
+    uint8_t live[LANE_GROUP];
+    uint8_t mask[LANE_GROUP];
+    uint8_t skip[LANE_GROUP] = { 0 };
+    uint32_t key[LANE_GROUP];
+    uint32_t lead = 0x10000;
+    int live_count = 0;
+    int count = 0;
+
+    if (g->converged) {
+        run_converged(lanes, g);
+        return true;
+    }
+
+    LANES(l) live[l] = -(uint8_t)(g->cycles[l] < g->end[l]);
+    LANES(l) key[l] = live[l] ? g->pc[l] : 0x10000;
+    LANES(l) lead = key[l] < lead ? key[l] : lead;
+
+    if (lead == 0x10000) return false;
+
+    // Too little vector work lately: every lane runs alone for a while instead
+    if (g->window_vector + g->window_scalar >= LANE_WINDOW) {
+        bool solo = g->window_vector < 3 * g->window_scalar;
+
+        g->window_vector = 0;
+        g->window_scalar = 0;
+
+        if (solo) {
+            for (int l = 0; l < LANE_GROUP; l++) {
+                if (live[l]) lanes->scalar_instructions += run_scalar(g, l, LANE_SOLO_RUN, false);
+            }
+
+            g->same_memory = lanes_share_memory(g);
+            return true;
+        }
+    }
+
+    LANES(l) mask[l] = -(uint8_t)(key[l] == lead);
+    LANES(l) live_count += live[l] & 1;
+    LANES(l) count += mask[l] & 1;
+
+    // Every lane at `lead` must hold the same instruction there
+    int first = 0;
+    while (!mask[first]) first++;
+
+    uint16_t addr = lead & (MEMORY_SIZE - 1);
+    const struct Instruction *ins = fetch(g->machines[first], addr);
+
+    if (!g->same_memory) {
+        for (int l = first + 1; l < LANE_GROUP; l++) {
+            if (mask[l] && fetch(g->machines[l], addr) != ins) {
+                mask[l] = 0;
+                count--;
+            }
+        }
+    }
+
+    lanes->steps++;
+    if (count != live_count) lanes->diverged_steps++;
+
+    enum LaneKind kind = lane_kind(ins, addr);
+
+    if (kind == LANE_SCALAR) {
+        for (int l = first; l < LANE_GROUP; l++) {
+            if (!mask[l]) continue;
+
+            const struct SharedMemory *shared = g->machines[l]->shared;
+            uint64_t executed = run_scalar(g, l, LANE_SCALAR_RUN, true);
+
+            lanes->scalar_instructions += executed;
+            g->window_scalar += executed;
+
+            if (g->machines[l]->shared != shared) g->same_memory = lanes_share_memory(g);
+        }
+
+        return true;
+    }
+
+    execute_vector(g, mask, kind, ins, skip);
+    lanes->vector_instructions += count;
+    g->window_vector += count;
+
+    if (kind == LANE_1NNN) {
+        LANES(l) g->pc[l] = (ins->nnn & (int8_t)mask[l]) | (g->pc[l] & ~(int8_t)mask[l]);
+    } else {
+        LANES(l) g->pc[l] += (2 + 2 * (skip[l] & 1)) & mask[l];
+    }
+
+    LANES(l) g->cycles[l] += mask[l] & 1;
+
+    // Everyone ran it and landed together: track control flow once from here
+    if (count == live_count) {
+        uint16_t pc = g->pc[first];
+        uint8_t together = 0xFF;
+        uint64_t budget = UINT64_MAX;
+
+        LANES(l) together &= -(uint8_t)(g->pc[l] == pc) | ~live[l];
+        LANES(l) budget = live[l] && g->end[l] - g->cycles[l] < budget ? g->end[l] - g->cycles[l] : budget;
+
+        if (together == 0xFF && budget > 0) {
+            memcpy(g->live, live, LANE_GROUP);
+            g->live_count = live_count;
+            g->first = first;
+            g->converged_pc = pc;
+            g->budget = budget;
+            g->converged = true;
+        }
+    }
+
+    return true;
+}
+
+static bool step_group_scalar(struct Lanes *lanes, struct LaneGroup *g) {
+    return step_group_body(lanes, g);
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+__attribute__((target("avx2")))
+static bool step_group_avx2(struct Lanes *lanes, struct LaneGroup *g) {
+    return step_group_body(lanes, g);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vl")))
+static bool step_group_avx512(struct Lanes *lanes, struct LaneGroup *g) {
+    return step_group_body(lanes, g);
+}
+#endif
+
+struct Lanes *create_lanes(struct Chip8 **machines, int count) {
+    struct Lanes *lanes = (struct Lanes *)calloc(1, sizeof(struct Lanes));
+
+    if (lanes == NULL) error("Failed to allocate lanes", true);
+
+    pthread_once(&lane_kinds_once, build_lane_kinds);
+
+    lanes->count = count;
+    lanes->group_count = (count + LANE_GROUP - 1) / LANE_GROUP;
+    lanes->groups = (struct LaneGroup *)aligned_alloc(64, lanes->group_count * sizeof(struct LaneGroup));
+
+    if (lanes->groups == NULL) error("Failed to allocate lanes", true);
+
+    memset(lanes->groups, 0, lanes->group_count * sizeof(struct LaneGroup));
+
+    for (int i = 0; i < count; i++) lanes->groups[i / LANE_GROUP].machines[i % LANE_GROUP] = machines[i];
+
+    lanes->step_group = &step_group_scalar;
+    lanes->target = "scalar";
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl")) {
+        lanes->step_group = &step_group_avx512;
+        lanes->target = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+        lanes->step_group = &step_group_avx2;
+        lanes->target = "avx2";
+    }
+#endif
+
+    return lanes;
+}
+
+void destroy_lanes(struct Lanes *lanes) {
+    free(lanes->groups);
+    free(lanes);
+}
+
+void run_lanes(struct Lanes *lanes, uint64_t count) {
+    for (int i = 0; i < lanes->group_count; i++) {
+        struct LaneGroup *g = &lanes->groups[i];
+
+        for (int l = 0; l < LANE_GROUP; l++) {
+            if (g->machines[l] == NULL) continue;
+
+            sync_from_machine(g, l);
+            g->end[l] = g->cycles[l] + count;
+        }
+
+        g->same_memory = lanes_share_memory(g);
+
+        // A group runs to completion before the next, so its lanes stay in cache
+        while (lanes->step_group(lanes, g));
+
+        for (int l = 0; l < LANE_GROUP; l++) {
+            if (g->machines[l] == NULL) continue;
+
+            sync_to_machine(g, l);
+            dispatch_events(g->machines[l]);
+        }
+    }
+}
+
+double lanes_divergence(const struct Lanes *lanes) {
+    return lanes->steps ? (double)lanes->diverged_steps / lanes->steps : 0.0;
+}
@@ -0,0 +1,43 @@
+#ifndef LANES_H
+#define LANES_H
+
+#include "chip8.h"
+
+// Lockstep batch engine for many copies of one ROM. Machines are stepped in
+// groups of LANE_GROUP lanes whose registers, PC, index and instruction count
+// live in structure-of-arrays form. Each step picks the lowest PC among a
+// group's live lanes; if the instruction there is a register, skip, jump or
+// ANNN op it runs once across every lane at that PC with vector code (AVX-512
+// or AVX2 where the host has it), otherwise each of those lanes goes through
+// cycle(). Lanes at higher PCs wait, so diverged lanes drift back together.
+// Memory, display, stack, timers, RNG and keypad stay in each lane's Chip8.
+
+#define LANE_GROUP 32 // One AVX2 register of 8-bit registers
+
+struct LaneGroup;
+
+struct Lanes {
+    int count; // Machines
+    int group_count;
+    struct LaneGroup *groups;
+    bool (*step_group)(struct Lanes *lanes, struct LaneGroup *group); // Kernel picked for this host
+    const char *target; // "avx512", "avx2" or "scalar"
+
+    // Statistics, accumulated over every run_lanes()
+    uint64_t steps;          // Group steps taken
+    uint64_t diverged_steps; // Steps where a group's live lanes were at more than one PC
+    uint64_t vector_instructions; // Lane-instructions run by the vector kernel
+    uint64_t scalar_instructions; // Lane-instructions run through cycle()
+};
+
+// The machines stay owned by the caller; lanes only borrow them
+struct Lanes *create_lanes(struct Chip8 **machines, int count);
+void destroy_lanes(struct Lanes *lanes);
+
+// Runs every machine `count` instructions (exactly as run_cycles() would) and
+// leaves their full state back in the Chip8s
+void run_lanes(struct Lanes *lanes, uint64_t count);
+
+double lanes_divergence(const struct Lanes *lanes); // diverged_steps / steps
+
+#endif
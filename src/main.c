@@ -1,6 +1,25 @@
+#include "audio.h"
 #include "chip8.h"
+#include "frames.h"
+#include "input.h"
+#include "journal.h"
+#include "present.h"
+#include "profile.h"
+#include "rewind.h"
+#include "savestate.h"
+#include "scheduler.h"
 
 #include <SDL2/SDL.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_BENCHMARK_INSTRUCTIONS 100000000ULL
+#define DEFAULT_FOREGROUND 0xFFFFFF
+#define DEFAULT_BACKGROUND 0x000000
+#define DEFAULT_KEY_MAP "x123qweasdzc4rfv" // Host keys for CHIP-8 keys 0-F (the usual 4x4 block)
+#define DEFAULT_WAV_SECONDS 10 // Emulated time dumped by -W unless -n says otherwise
 
 struct Platform {
     const char *title;
@@ -11,9 +30,18 @@ struct Platform {
     unsigned int texture_width;
     unsigned int texture_height;
 
+    int refresh_rate; // Host display refresh in Hz
+
+    bool save_requested; // F5, handled by the main loop
+    bool load_requested; // F9
+    bool rewind_held;    // Backspace
+
+    int8_t keymap[SDL_NUM_SCANCODES]; // CHIP-8 key per host scancode, -1 if unmapped
+
     SDL_Window *window;
     SDL_Renderer *renderer;
     SDL_Texture *texture;
+    SDL_AudioDeviceID audio; // 0 if there is no audio
 } platform;
 
 void initialise_platform(const char *title,
@@ -27,14 +55,23 @@ void initialise_platform(const char *title,
     platform.texture_width = texture_width;
     platform.texture_height = texture_height;
 
-    SDL_Init(SDL_INIT_VIDEO);
+    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
 
     platform.window = SDL_CreateWindow(title, 0, 0, window_width, window_height, SDL_WINDOW_SHOWN);
     platform.renderer = SDL_CreateRenderer(platform.window, -1, SDL_RENDERER_ACCELERATED);
     platform.texture = SDL_CreateTexture(platform.renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, texture_width, texture_height);
+
+    SDL_DisplayMode mode;
+    platform.refresh_rate = 60;
+
+    if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(platform.window), &mode) == 0 && mode.refresh_rate > 0) {
+        platform.refresh_rate = mode.refresh_rate;
+    }
 }
 
 void cleanup_platform() {
+    if (platform.audio != 0) SDL_CloseAudioDevice(platform.audio);
+
     SDL_DestroyTexture(platform.texture);
     SDL_DestroyRenderer(platform.renderer);
     SDL_DestroyWindow(platform.window);
@@ -42,208 +79,751 @@ void cleanup_platform() {
     SDL_Quit();
 }
 
-void update(const void *buffer, int pitch) {
-    SDL_UpdateTexture(platform.texture, NULL, buffer, pitch);
+// Runs on SDL's audio thread
+void audio_callback(void *userdata, Uint8 *stream, int len) {
+    render_beeper((struct Beeper *)userdata, (int16_t *)stream, len / (int)sizeof(int16_t));
+}
+
+// Mono 16-bit at whatever rate the device prefers; `samples` per callback sets
+// the latency floor. Without a device the emulator simply runs silent.
+bool open_audio(struct Beeper *beeper, int samples) {
+    SDL_AudioSpec want = { 0 };
+    SDL_AudioSpec have;
+
+    want.freq = DEFAULT_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = samples;
+    want.callback = audio_callback;
+    want.userdata = beeper;
+
+    platform.audio = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+
+    if (platform.audio == 0) {
+        error("Failed to open audio device, running silent", false);
+        return false;
+    }
+
+    // The device starts paused, so the callback can't see the beeper half set up
+    initialise_beeper(beeper, have.freq, BEEPER_HZ, BEEPER_AMPLITUDE);
+    SDL_PauseAudioDevice(platform.audio, 0);
+
+    fprintf(stderr, "audio: %d Hz, %u-sample buffer (%.1f ms)\n", have.freq, have.samples, have.samples * 1e3 / have.freq);
+    return true;
+}
+
+// Draws straight into the streaming texture, already at window size, so SDL
+// only copies it; returns true while phosphor fading needs another present
+bool update(struct Presenter *presenter, const uint64_t *display) {
+    void *pixels;
+    int pitch;
+    bool fading = false;
+
+    if (SDL_LockTexture(platform.texture, NULL, &pixels, &pitch) == 0) {
+        fading = present_display(presenter, display, pixels, pitch);
+        SDL_UnlockTexture(platform.texture);
+    }
+
     SDL_RenderClear(platform.renderer);
     SDL_RenderCopy(platform.renderer, platform.texture, NULL, NULL);
     SDL_RenderPresent(platform.renderer);
+    return fading;
 }
 
-bool process_input(uint8_t keys) {
+// `map` names the host key for each CHIP-8 key 0-F, one character each
+bool set_keymap(const char *map) {
+    if (strlen(map) != 16) return false;
+
+    memset(platform.keymap, -1, sizeof(platform.keymap));
+
+    for (int key = 0; key < 16; key++) {
+        char name[2] = { map[key], '\0' };
+        SDL_Scancode scancode = SDL_GetScancodeFromName(name);
+
+        if (scancode == SDL_SCANCODE_UNKNOWN) return false;
+
+        platform.keymap[scancode] = key;
+    }
+
+    return true;
+}
+
+// Mapped keys become timestamped events in `input`; hotkeys set platform flags
+bool process_input(struct InputRing *input) {
     bool quit = false;
     SDL_Event event;
 
     while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-            case SDL_QUIT:
+        if (event.type == SDL_QUIT) quit = true;
+        if (event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) continue;
+
+        bool pressed = event.type == SDL_KEYDOWN;
+
+        switch (event.key.keysym.sym) {
+            case SDLK_ESCAPE:
                 quit = true;
                 break;
 
-            case SDL_KEYDOWN:
-                switch (event.key.keysym.sym) {
-                    case SDLK_ESCAPE:
-                        quit = true;
-                        break;
+            case SDLK_F5:
+                if (pressed) platform.save_requested = true;
+                break;
+
+            case SDLK_F9:
+                if (pressed) platform.load_requested = true;
+                break;
+
+            case SDLK_BACKSPACE:
+                platform.rewind_held = pressed;
+                break;
+
+            default: {
+                int8_t key = platform.keymap[event.key.keysym.scancode];
+
+                if (key < 0 || event.key.repeat) break;
+
+                struct KeyEvent key_event = { monotonic_ns(), (uint8_t)key, pressed };
+
+                if (!push_key_event(input, &key_event)) error("Input ring full, key event dropped", false);
+                break;
+            }
+        }
+    }
+
+    return quit;
+}
 
-                    case SDLK_x:
-                        state.keys[0] = 1;
-                        break;
+// Profiling swaps in its own step loop, so the unprofiled path stays untouched
+void run_machine(struct Chip8 *machine, struct Profile *profile, uint64_t count) {
+    if (profile != NULL) run_cycles_profiled(profile, machine, count);
+    else run_cycles(machine, count);
+}
 
-                    case SDLK_1:
-                        state.keys[0x1] = 1;
-                        break;
+void finish_profile(struct Profile *profile, const struct Chip8 *machine, const char *folded_filename) {
+    write_profile_report(profile, machine, stderr);
 
-                    case SDLK_2:
-                        state.keys[0x2] = 1;
-                        break;
+    if (!write_folded_stacks(profile, folded_filename)) error("Failed to write folded stacks", false);
+    else fprintf(stderr, "\nfolded stacks written to %s\n", folded_filename);
 
-                    case SDLK_3:
-                        state.keys[0x3] = 1;
-                        break;
+    destroy_profile(profile);
+}
 
-                    case SDLK_q:
-                        state.keys[0x4] = 1;
-                        break;
+// Uncapped, headless runs: no window, no pacing, no presentation
+struct Benchmark {
+    bool enabled;
+    uint64_t instructions; // Per run; 0 means run for `seconds` instead
+    double seconds;
+    int repeats;
+    uint64_t seed;
+};
+
+struct BenchmarkRun {
+    uint64_t instructions; // Including idle-skipped ones
+    uint64_t idle_cycles;
+    double seconds;
+};
+
+struct BenchmarkRun benchmark_once(struct Chip8 *machine, struct Profile *profile, const uint8_t *rom, size_t rom_size,
+                                   int cycles_per_frame, const struct Benchmark *benchmark) {
+    struct BenchmarkRun run;
+
+    initialise(machine);
+    seed_random(machine, benchmark->seed); // Same RNG stream every run
+    machine->cycles_per_frame = cycles_per_frame;
+    load_rom_data(machine, rom, rom_size);
+
+    uint64_t start = monotonic_ns();
+    uint64_t elapsed = 0;
+
+    if (benchmark->instructions > 0) {
+        run_machine(machine, profile, benchmark->instructions);
+        elapsed = monotonic_ns() - start;
+    } else {
+        // Check the clock once per emulated second
+        uint64_t limit = (uint64_t)(benchmark->seconds * 1e9);
+
+        while (elapsed < limit) {
+            run_machine(machine, profile, (uint64_t)cycles_per_frame * TIMER_HZ);
+            elapsed = monotonic_ns() - start;
+        }
+    }
 
-                    case SDLK_w: 
-                        state.keys[0x5] = 1;
-                        break;
+    run.instructions = machine->cycles;
+    run.idle_cycles = machine->idle_cycles;
+    run.seconds = elapsed * 1e-9;
+    return run;
+}
 
-                    case SDLK_e:
-                        state.keys[0x6] = 1;
-                        break;
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
 
-                    case SDLK_a:
-                        state.keys[0x7] = 1;
-                        break;
+    return (x > y) - (x < y);
+}
 
-                    case SDLK_s:
-                        state.keys[0x8] = 1;
-                        break;
+// Profiles accumulate over every repeat
+void run_benchmark(const char *filename, int cycles_per_frame, const struct Benchmark *benchmark, const char *profile_filename) {
+    size_t rom_size;
+    uint8_t *rom = read_rom(filename, &rom_size);
+    struct Chip8 *machine = create_machine();
+    struct Profile *profile = profile_filename != NULL ? create_profile() : NULL;
+    double *ns_per_instruction = (double *)malloc(benchmark->repeats * sizeof(double));
+
+    for (int i = 0; i < benchmark->repeats; i++) {
+        struct BenchmarkRun run = benchmark_once(machine, profile, rom, rom_size, cycles_per_frame, benchmark);
+        double mips = run.instructions / run.seconds * 1e-6;
+        double executed_mips = (run.instructions - run.idle_cycles) / run.seconds * 1e-6; // Core speed alone
+        double fps = run.instructions / (double)cycles_per_frame / run.seconds;
+
+        printf("run %d: %llu instructions (%llu idle-skipped) in %.3f s, %.1f MIPS (%.1f executed), %.0f frames/s (%.0fx real time)\n",
+               i + 1, (unsigned long long)run.instructions, (unsigned long long)run.idle_cycles,
+               run.seconds, mips, executed_mips, fps, fps / TIMER_HZ);
+
+        ns_per_instruction[i] = run.seconds * 1e9 / run.instructions;
+    }
 
-                    case SDLK_d:
-                        state.keys[0x9] = 1;
-                        break;
+    if (benchmark->repeats > 1) {
+        qsort(ns_per_instruction, benchmark->repeats, sizeof(double), compare_doubles);
 
-                    case SDLK_z:
-                        state.keys[0xA] = 1;
-                        break;
+        // p99 is the slow tail: the 99th percentile of time per instruction (nearest rank)
+        double median = ns_per_instruction[benchmark->repeats / 2];
+        double p99 = ns_per_instruction[(benchmark->repeats * 99 + 99) / 100 - 1];
 
-                    case SDLK_c:
-                        state.keys[0xB] = 1;
-                        break;
+        printf("%d runs: median %.1f MIPS (%.2f ns/instruction), p99 %.1f MIPS (%.2f ns/instruction)\n",
+               benchmark->repeats, 1e3 / median, median, 1e3 / p99, p99);
+    }
 
-                    case SDLK_4:
-                        state.keys[0xC] = 1;
-                        break;
+    free(ns_per_instruction);
+    if (profile != NULL) finish_profile(profile, machine, profile_filename);
+    destroy_machine(machine);
+    free(rom);
+}
 
-                    case SDLK_r:
-                        state.keys[0xD] = 1;
-                        break;
+// Re-runs a recorded session headless and uncapped, then prints the final state
+void run_replay(const char *filename, const char *journal_filename) {
+    struct Journal *journal = load_journal(journal_filename);
 
-                    case SDLK_f:
-                        state.keys[0xE] = 1;
-                        break;
+    if (journal == NULL) exit(1);
 
-                    case SDLK_v: 
-                        state.keys[0xF] = 1;
-                        break;
+    size_t rom_size;
+    uint8_t *rom = read_rom(filename, &rom_size);
+    struct Chip8 *machine = create_machine();
 
-                    default:
-                        break;
-                }
-                break;
+    uint64_t start = monotonic_ns();
+    bool ok = replay_journal(journal, machine, rom, rom_size);
+    double seconds = (monotonic_ns() - start) * 1e-9;
+
+    if (ok) {
+        printf("replayed %zu key changes over %llu instructions in %.3f s (%.1f MIPS)\n",
+               journal->count, (unsigned long long)machine->cycles, seconds, machine->cycles / seconds * 1e-6);
+        printf("pc=%03X I=%03X sp=%u display=%08x V=", machine->pc, machine->index, machine->sp,
+               crc32c(machine->display, sizeof(machine->display)));
+
+        for (int r = 0; r < 16; r++) printf("%02X ", machine->registers[r]);
+        printf("\n");
+    }
+
+    destroy_machine(machine);
+    destroy_journal(journal);
+    free(rom);
+
+    if (!ok) exit(1);
+}
+
+// Emulated time as output samples: a frame of instructions is 1/60 s
+uint64_t cycles_to_samples(uint64_t cycles, int cycles_per_frame, uint32_t sample_rate) {
+    return (uint64_t)((unsigned __int128)cycles * sample_rate / ((uint64_t)cycles_per_frame * TIMER_HZ));
+}
+
+struct WavDump {
+    struct Beeper beeper;
+    uint64_t beeps;
+};
+
+// Headless, every sound change lands on the sample its cycle maps to
+void on_wav_event(void *context, struct Chip8 *state, const struct Event *event) {
+    struct WavDump *dump = (struct WavDump *)context;
+
+    if (event->type != EVENT_SOUND_ON && event->type != EVENT_SOUND_OFF) return;
+
+    uint64_t sample = cycles_to_samples(event->cycle, state->cycles_per_frame, dump->beeper.sample_rate);
+
+    if (!push_beeper_event(&dump->beeper, sample, event->type == EVENT_SOUND_ON)) error("Beeper ring full, sound change dropped", false);
+    if (event->type == EVENT_SOUND_ON) dump->beeps++;
+}
+
+// Renders the ROM's sound on emulated time, uncapped, so beep timing can be
+// checked to the sample without a device or a wall clock in the way
+void run_wav_dump(const char *filename, int cycles_per_frame, uint64_t seed, uint64_t instructions, const char *wav_filename) {
+    static struct WavDump dump;
+    struct WavWriter wav;
+    int16_t buffer[DEFAULT_AUDIO_SAMPLES];
+
+    initialise_beeper(&dump.beeper, DEFAULT_SAMPLE_RATE, BEEPER_HZ, BEEPER_AMPLITUDE);
+
+    if (!open_wav(&wav, wav_filename, DEFAULT_SAMPLE_RATE)) exit(1);
+
+    size_t rom_size;
+    uint8_t *rom = read_rom(filename, &rom_size);
+    struct Chip8 *machine = create_machine();
+
+    seed_random(machine, seed);
+    machine->cycles_per_frame = cycles_per_frame;
+    load_rom_data(machine, rom, rom_size);
+    machine->event_handler = on_wav_event;
+    machine->event_context = &dump;
+
+    // One frame at a time, so the ring only ever holds a frame's sound changes
+    while (machine->cycles < instructions) {
+        uint64_t count = instructions - machine->cycles;
+
+        run_cycles(machine, count < (uint64_t)cycles_per_frame ? count : (uint64_t)cycles_per_frame);
+
+        uint64_t due = cycles_to_samples(machine->cycles, cycles_per_frame, DEFAULT_SAMPLE_RATE);
+
+        while (beeper_position(&dump.beeper) + DEFAULT_AUDIO_SAMPLES <= due) {
+            render_beeper(&dump.beeper, buffer, DEFAULT_AUDIO_SAMPLES);
+            write_wav(&wav, buffer, DEFAULT_AUDIO_SAMPLES);
+        }
+    }
+
+    int rest = (int)(cycles_to_samples(machine->cycles, cycles_per_frame, DEFAULT_SAMPLE_RATE) - beeper_position(&dump.beeper));
 
-            case SDL_KEYUP:
-                switch (event.key.keysym.sym) {
-                    case SDLK_ESCAPE:
-                        quit = true;
-                        break;
+    render_beeper(&dump.beeper, buffer, rest);
+    write_wav(&wav, buffer, rest);
 
-                    case SDLK_x:
-                        state.keys[0] = 0;
-                        break;
+    bool ok = close_wav(&wav);
 
-                    case SDLK_1:
-                        state.keys[0x1] = 0;
-                        break;
+    if (ok) {
+        printf("%llu instructions, %llu beeps: %llu samples (%.3f s) written to %s\n",
+               (unsigned long long)machine->cycles, (unsigned long long)dump.beeps,
+               (unsigned long long)wav.samples, (double)wav.samples / DEFAULT_SAMPLE_RATE, wav_filename);
+    }
 
-                    case SDLK_2:
-                        state.keys[0x2] = 0;
-                        break;
+    destroy_machine(machine);
+    free(rom);
 
-                    case SDLK_3:
-                        state.keys[0x3] = 0;
-                        break;
+    if (!ok) exit(1);
+}
 
-                    case SDLK_q:
-                        state.keys[0x4] = 0;
-                        break;
+void finish_journal(struct Journal *journal, const char *journal_filename) {
+    if (save_journal(journal, journal_filename)) {
+        fprintf(stderr, "journal: %zu key changes over %llu instructions written to %s\n",
+                journal->count, (unsigned long long)journal->end_cycle, journal_filename);
+    }
 
-                    case SDLK_w: 
-                        state.keys[0x5] = 0;
-                        break;
+    destroy_journal(journal);
+}
 
-                    case SDLK_e:
-                        state.keys[0x6] = 0;
-                        break;
+// Interactive runs split in two: the render thread (main, which owns SDL)
+// handles input and presentation, the emulator thread paces and runs the
+// machine, so a stalled SDL_RenderPresent never holds up emulation. They meet
+// only in the atomics below and the frame triple buffer.
+struct Session {
+    struct Chip8 *machine; // Emulator thread's, until it is joined
+    struct Profile *profile;
+    struct Journal *journal;
+    const char *journal_filename;
+    struct Rewind *rewind;
+    char state_filename[4096];
+    struct Scheduler scheduler;
+
+    struct TripleBuffer frames;
+    Uint32 frame_event; // Pushed after each published frame to wake the render thread
+
+    struct InputRing input; // Key events, render thread to emulator thread
+    uint64_t pending_input_ns; // Emulator thread: press not yet answered by a changed frame
+
+    // Emulator thread: sound changes to the audio callback, NULL when silent
+    struct Beeper *beeper;
+    bool beeper_on;        // Last state queued
+    uint64_t batch;        // wait_frame() batches so far
+    uint64_t sound_batch;  // Batch, cycle and sample of the last change queued
+    uint64_t sound_cycle;
+    uint64_t sound_sample;
+
+    // Written by the render thread
+    bool save_requested;
+    bool load_requested;
+    bool rewind_held;
+    bool quit;
+};
+
+// Hands the render thread's hotkeys to the emulator thread
+void publish_hotkeys(struct Session *session) {
+    if (platform.save_requested) __atomic_store_n(&session->save_requested, true, __ATOMIC_RELEASE);
+    if (platform.load_requested) __atomic_store_n(&session->load_requested, true, __ATOMIC_RELEASE);
+    __atomic_store_n(&session->rewind_held, platform.rewind_held, __ATOMIC_RELEASE);
+
+    platform.save_requested = false;
+    platform.load_requested = false;
+}
 
-                    case SDLK_a:
-                        state.keys[0x7] = 0;
-                        break;
+// Applies a key event: journalled, and its press timed until a frame answers it
+void apply_key_event(struct Session *session, const struct KeyEvent *event) {
+    set_key(session->machine, event->key, event->pressed);
 
-                    case SDLK_s:
-                        state.keys[0x8] = 0;
-                        break;
+    if (event->pressed && session->pending_input_ns == 0) session->pending_input_ns = event->time_ns;
+    if (session->journal != NULL) journal_record(session->journal, session->machine);
+}
 
-                    case SDLK_d:
-                        state.keys[0x9] = 0;
-                        break;
+// Runs one frame standing for the wall-clock span [start_ns, start_ns + span_ns),
+// applying each key event polled in it at the matching instruction boundary.
+// Input lags by exactly the frames in the batch, with no jitter from when polling
+// happened to run, and a tap inside one frame still reaches the program.
+void run_frame_with_input(struct Session *session, uint64_t start_ns, uint64_t span_ns) {
+    struct Chip8 *machine = session->machine;
+    uint64_t first = machine->cycles;
+    uint64_t count = machine->cycles_per_frame;
+    const struct KeyEvent *event;
 
-                    case SDLK_z:
-                        state.keys[0xA] = 0;
-                        break;
+    while ((event = peek_key_event(&session->input)) != NULL && event->time_ns < start_ns + span_ns) {
+        uint64_t at = first + key_event_offset(event->time_ns, start_ns, span_ns, count);
 
-                    case SDLK_c:
-                        state.keys[0xB] = 0;
-                        break;
+        if (at > machine->cycles) run_machine(machine, session->profile, at - machine->cycles);
 
-                    case SDLK_4:
-                        state.keys[0xC] = 0;
-                        break;
+        apply_key_event(session, event);
+        pop_key_event(&session->input);
+    }
+
+    run_machine(machine, session->profile, first + count - machine->cycles);
+}
 
-                    case SDLK_r:
-                        state.keys[0xD] = 0;
-                        break;
+// Queues a sound change for the audio callback. The batch just run stands for
+// wall time that has already passed, so its changes start at the playback
+// position: about one callback buffer from being heard. Within a batch they
+// keep their emulated spacing, so a one-frame beep still lasts 1/60 s.
+void queue_beep(struct Session *session, uint64_t cycle, bool on) {
+    if (session->beeper == NULL || on == session->beeper_on) return;
 
-                    case SDLK_f:
-                        state.keys[0xE] = 0;
-                        break;
+    uint64_t sample = beeper_position(session->beeper);
 
-                    case SDLK_v: 
-                        state.keys[0xF] = 0;
-                        break;
+    if (session->sound_batch == session->batch && cycle >= session->sound_cycle) {
+        uint64_t spaced = session->sound_sample + cycles_to_samples(cycle - session->sound_cycle,
+                                                                    session->machine->cycles_per_frame,
+                                                                    session->beeper->sample_rate);
+
+        if (spaced > sample) sample = spaced;
+    }
 
-                    default:
-                        break;
+    if (sample < session->sound_sample) sample = session->sound_sample; // Events go in sample order
+
+    if (!push_beeper_event(session->beeper, sample, on)) {
+        error("Beeper ring full, sound change dropped", false);
+        return;
+    }
+
+    session->beeper_on = on;
+    session->sound_batch = session->batch;
+    session->sound_cycle = cycle;
+    session->sound_sample = sample;
+}
+
+void on_machine_event(void *context, struct Chip8 *state, const struct Event *event) {
+    struct Session *session = (struct Session *)context;
+
+    if (event->type == EVENT_SOUND_ON || event->type == EVENT_SOUND_OFF) {
+        queue_beep(session, event->cycle, event->type == EVENT_SOUND_ON);
+    }
+}
+
+// Loading or rewinding jumps the sound timer without an event
+void sync_beeper(struct Session *session) {
+    queue_beep(session, session->machine->cycles, sound_active(session->machine));
+}
+
+void *emulate(void *arg) {
+    struct Session *session = (struct Session *)arg;
+    struct Chip8 *machine = session->machine;
+    uint32_t published_generation = machine->display_generation - 1;
+
+    initialise_scheduler(&session->scheduler, TIMER_HZ);
+
+    machine->event_handler = on_machine_event;
+    machine->event_context = session;
+
+    while (!__atomic_load_n(&session->quit, __ATOMIC_ACQUIRE)) {
+        // Sleep to the next 60 Hz deadline; after a stall, run the frames we owe back to back
+        unsigned int frames = wait_frame(&session->scheduler);
+        session->batch++;
+        bool rewind_held = __atomic_load_n(&session->rewind_held, __ATOMIC_ACQUIRE);
+        bool save_requested = __atomic_exchange_n(&session->save_requested, false, __ATOMIC_ACQ_REL);
+        bool load_requested = __atomic_exchange_n(&session->load_requested, false, __ATOMIC_ACQ_REL);
+
+        // A journal can't describe a jump in state, so rewinding or loading ends it
+        if (session->journal != NULL && (rewind_held || load_requested)) {
+            error("Rewind or load ends the input journal here", false);
+            finish_journal(session->journal, session->journal_filename);
+            session->journal = NULL;
+        }
+
+        if (session->journal != NULL) journal_record(session->journal, machine);
+
+        if (save_requested && save_state_file(machine, session->state_filename)) {
+            fprintf(stderr, "saved %s\n", session->state_filename);
+        }
+
+        if (load_requested && restore_state_file(machine, session->state_filename)) {
+            fprintf(stderr, "loaded %s\n", session->state_filename);
+            sync_beeper(session);
+        }
+
+        // This batch stands for the wall-clock span that just ended
+        uint64_t period = session->scheduler.period_ns;
+        uint64_t now = monotonic_ns();
+        uint64_t start = now - frames * period;
+
+        for (unsigned int i = 0; i < frames; i++) {
+            if (rewind_held) {
+                // Step back one frame per frame held, keeping the live keys
+                uint16_t keys = keypad_mask(machine);
+                const struct KeyEvent *event;
+
+                while ((event = peek_key_event(&session->input)) != NULL && event->time_ns < now) {
+                    if (event->pressed) keys |= 1 << event->key;
+                    else keys &= ~(1 << event->key);
+
+                    pop_key_event(&session->input);
                 }
-                break;
 
-            default:
-                break;
+                rewind_step_back(session->rewind, machine);
+                set_keypad_mask(machine, keys);
+                sync_beeper(session);
+            } else {
+                run_frame_with_input(session, start + i * period, period);
+                rewind_capture(session->rewind, machine);
+            }
         }
+
+        // Unchanged frames are never handed over
+        if (machine->display_generation == published_generation) continue;
+
+        struct Frame *frame = back_frame(&session->frames);
+
+        memcpy(frame->display, machine->display, sizeof(frame->display));
+        frame->generation = machine->display_generation;
+        frame->input_ns = session->pending_input_ns;
+        publish_frame(&session->frames);
+
+        published_generation = machine->display_generation;
+        session->pending_input_ns = 0;
+
+        SDL_Event event = { 0 };
+
+        event.type = session->frame_event;
+        SDL_PushEvent(&event);
     }
+
+    return NULL;
+}
+
+void usage() {
+    fprintf(stderr,
+            "Usage: chip8 [options] <video scale> <instructions per frame> <ROM>\n"
+            "  -b               benchmark: run uncapped and headless, then report speed\n"
+            "  -n INSTRUCTIONS  instructions per benchmark run (default %llu; implies -b)\n"
+            "  -t SECONDS       run each benchmark for this long instead (implies -b)\n"
+            "  -r REPEATS       benchmark runs, summarised as median/p99 (default 1)\n"
+            "  -p FILE          profile: report per handler, PC and DXYN height on exit,\n"
+            "                   and write folded call stacks to FILE\n"
+            "  -S SEED          RNG seed (default: from the clock, printed at startup)\n"
+            "  -J FILE          record an input journal to FILE for deterministic replay\n"
+            "  -R FILE          replay the journal in FILE headless and uncapped, then\n"
+            "                   print the final state\n"
+            "  -k MAP           host keys for CHIP-8 keys 0-F, one character each\n"
+            "                   (default %s)\n"
+            "  -c FG:BG         pixel colours as RRGGBB hex (default %06X:%06X)\n"
+            "  -l               darken the last row of each scaled pixel (scanlines)\n"
+            "  -d PERSISTENCE   phosphor: an unlit pixel keeps PERSISTENCE/256 of its glow\n"
+            "                   per frame, hiding sprite flicker (0-255, default 0)\n"
+            "  -a SAMPLES       audio buffer per callback, at least %d; smaller is lower\n"
+            "                   latency (default %d, %.1f ms at %d Hz)\n"
+            "  -W FILE          write the ROM's sound to FILE as WAV, headless and on\n"
+            "                   emulated time (%d s, or -n instructions)\n",
+            DEFAULT_BENCHMARK_INSTRUCTIONS, DEFAULT_KEY_MAP, DEFAULT_FOREGROUND, DEFAULT_BACKGROUND,
+            MIN_AUDIO_SAMPLES, DEFAULT_AUDIO_SAMPLES, DEFAULT_AUDIO_SAMPLES * 1e3 / DEFAULT_SAMPLE_RATE,
+            DEFAULT_SAMPLE_RATE, DEFAULT_WAV_SECONDS);
+    error("Invalid arguments provided to program", true);
 }
 
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        error("Invalid arguments provided to program", true);
+    struct Benchmark benchmark = { false, DEFAULT_BENCHMARK_INSTRUCTIONS, 0, 1, 1 };
+    const char *profile_filename = NULL;
+    const char *journal_filename = NULL;
+    const char *replay_filename = NULL;
+    const char *key_map = DEFAULT_KEY_MAP;
+    unsigned long foreground = DEFAULT_FOREGROUND;
+    unsigned long background = DEFAULT_BACKGROUND;
+    bool scanlines = false;
+    int persistence = 0;
+    int audio_samples = DEFAULT_AUDIO_SAMPLES;
+    const char *wav_filename = NULL;
+    bool instructions_given = false;
+    char *end;
+    uint64_t seed = (uint64_t)time(NULL);
+    bool seeded = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bn:t:r:p:S:J:R:k:c:ld:a:W:")) != -1) {
+        switch (opt) {
+            case 'b': benchmark.enabled = true; break;
+            case 'n': benchmark.enabled = true; benchmark.instructions = strtoull(optarg, NULL, 0); benchmark.seconds = 0; instructions_given = true; break;
+            case 't': benchmark.enabled = true; benchmark.seconds = atof(optarg); benchmark.instructions = 0; break;
+            case 'r': benchmark.repeats = atoi(optarg); break;
+            case 'p': profile_filename = optarg; break;
+            case 'S': seed = strtoull(optarg, NULL, 0); seeded = true; break;
+            case 'J': journal_filename = optarg; break;
+            case 'R': replay_filename = optarg; break;
+            case 'k': key_map = optarg; break;
+            case 'c':
+                foreground = strtoul(optarg, &end, 16);
+                if (*end != ':') usage();
+                background = strtoul(end + 1, &end, 16);
+                if (*end != '\0' || foreground > 0xFFFFFF || background > 0xFFFFFF) usage();
+                break;
+            case 'l': scanlines = true; break;
+            case 'd': persistence = atoi(optarg); break;
+            case 'a': audio_samples = atoi(optarg); break;
+            case 'W': wav_filename = optarg; break;
+            default: usage();
+        }
     }
 
-    int video_scale = atoi(argv[1]);
-    int cycle_delay = atoi(argv[2]);
-    const char *filename = argv[3];
+    if (argc - optind != 3) usage();
+
+    int video_scale = atoi(argv[optind]);
+    int cycles_per_frame = atoi(argv[optind + 1]);
+    const char *filename = argv[optind + 2];
+
+    if (cycles_per_frame < 1) error("Instructions per frame must be at least 1", true);
+
+    if (replay_filename != NULL) {
+        run_replay(filename, replay_filename);
+        return 0;
+    }
+
+    // Before the benchmark: -n picks the length of the dump too
+    if (wav_filename != NULL) {
+        uint64_t instructions = instructions_given ? benchmark.instructions
+                                                   : (uint64_t)cycles_per_frame * TIMER_HZ * DEFAULT_WAV_SECONDS;
+
+        run_wav_dump(filename, cycles_per_frame, seed, instructions, wav_filename);
+        return 0;
+    }
+
+    if (benchmark.enabled) {
+        if (seeded) benchmark.seed = seed;
+        if (benchmark.repeats < 1 || (benchmark.instructions == 0 && benchmark.seconds <= 0)) usage();
+
+        run_benchmark(filename, cycles_per_frame, &benchmark, profile_filename);
+        return 0;
+    }
+
+    if (!set_keymap(key_map)) error("Key map needs 16 single-character key names", true);
+    if (persistence < 0 || persistence > 255) usage();
+    if (audio_samples < MIN_AUDIO_SAMPLES || audio_samples > 8192) usage();
+
+    // Colours as RGBA8888, opaque
+    struct Presenter presenter;
+    initialise_presenter(&presenter, video_scale, foreground << 8 | 0xFF, background << 8 | 0xFF, scanlines, persistence);
+
+    initialise_platform("Chip-8 Interpreter", SCREEN_WIDTH * video_scale, SCREEN_HEIGHT * video_scale,
+                        SCREEN_WIDTH * video_scale, SCREEN_HEIGHT * video_scale);
+    struct Chip8 *machine = create_machine();
+    size_t rom_size;
+    uint8_t *rom = read_rom(filename, &rom_size);
+
+    seed_random(machine, seed);
+    machine->cycles_per_frame = cycles_per_frame;
+    load_rom_data(machine, rom, rom_size);
+    fprintf(stderr, "seed: %llu\n", (unsigned long long)seed);
+
+    struct Session session = { 0 };
+
+    session.machine = machine;
+    session.journal = journal_filename != NULL ? create_journal(seed, cycles_per_frame, rom, rom_size) : NULL;
+    session.journal_filename = journal_filename;
+    free(rom);
+
+    session.profile = profile_filename != NULL ? create_profile() : NULL;
 
-    initialise_platform("Chip-8 Interpreter", SCREEN_WIDTH * video_scale, SCREEN_HEIGHT * video_scale, SCREEN_WIDTH, SCREEN_HEIGHT); 
-    initialise();
-    load_rom(filename);
+    session.rewind = create_rewind(DEFAULT_REWIND_BYTES);
+    rewind_capture(session.rewind, machine);
 
-    int video_pitch = sizeof(state.display[0]) * SCREEN_WIDTH;
+    // Quick save slot next to the ROM
+    snprintf(session.state_filename, sizeof(session.state_filename), "%s.state", filename);
 
-    clock_t last_time = clock();
+    initialise_triple_buffer(&session.frames);
+    initialise_input_ring(&session.input);
+    session.frame_event = SDL_RegisterEvents(1);
+
+    static struct Beeper beeper; // Outlives the audio device, closed in cleanup_platform()
+
+    if (open_audio(&beeper, audio_samples)) session.beeper = &beeper;
+
+    pthread_t emulator;
+
+    if (pthread_create(&emulator, NULL, emulate, &session) != 0) error("Failed to start emulator thread", true);
+
+    struct LatencyHistogram latency = { 0 };
+    const struct Frame *shown = NULL; // Front slot of the triple buffer, ours until the next take_frame()
+    bool fading = false;
     bool quit = false;
 
-    while (!quit) {
-        quit = process_input(state.keypad);
+    // The render thread owns SDL: it sleeps until input arrives or a frame is
+    // published, and presents the newest frame at most once per host refresh
+    Uint64 present_interval = SDL_GetPerformanceFrequency() / platform.refresh_rate;
+    Uint64 next_present = 0;
 
-        clock_t current_time = clock();
-        clock_t dt = current_time - last_time;
+    while (!quit) {
+        Uint64 now = SDL_GetPerformanceCounter();
 
-        if (dt > cycle_delay) {
-            cycle();
-            update();
+        if (!frame_ready(&session.frames) && !fading) {
+            SDL_WaitEvent(NULL);
+        } else if (now < next_present) {
+            SDL_WaitEventTimeout(NULL, (int)((next_present - now) * 1000 / SDL_GetPerformanceFrequency()) + 1);
         }
+
+        quit = process_input(&session.input);
+        publish_hotkeys(&session);
+
+        now = SDL_GetPerformanceCounter();
+
+        if (now < next_present) continue;
+
+        // Fading pixels keep the last frame on screen until they settle
+        const struct Frame *frame = take_frame(&session.frames);
+
+        if (frame == NULL && !fading) continue;
+        if (frame != NULL) shown = frame;
+
+        fading = update(&presenter, shown->display);
+        next_present = now + present_interval;
+
+        if (frame != NULL && frame->input_ns != 0) record_latency(&latency, monotonic_ns() - frame->input_ns);
+    }
+
+    __atomic_store_n(&session.quit, true, __ATOMIC_RELEASE);
+    pthread_join(emulator, NULL);
+
+    fprintf(stderr, "frames: %llu, missed deadlines: %llu, dropped frames: %llu\n",
+            (unsigned long long)session.scheduler.frames,
+            (unsigned long long)session.scheduler.missed_deadlines,
+            (unsigned long long)session.scheduler.dropped_frames);
+    fprintf(stderr, "idle skips: %llu (%llu instructions fast-forwarded)\n",
+            (unsigned long long)machine->idle_skips,
+            (unsigned long long)machine->idle_cycles);
+    write_latency_report(&latency, stderr);
+
+    if (session.profile != NULL) finish_profile(session.profile, machine, profile_filename);
+
+    if (session.journal != NULL) {
+        journal_record(session.journal, machine);
+        finish_journal(session.journal, journal_filename);
     }
 
+    destroy_rewind(session.rewind);
+    destroy_machine(machine);
+    cleanup_platform();
+
     return 0;
 }
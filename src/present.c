@@ -0,0 +1,293 @@
+#include "present.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+
+// Per-channel mix of two colours, level 0 = from, 255 = to
+static uint32_t mix_colour(uint32_t from, uint32_t to, unsigned int level) {
+    uint32_t colour = 0;
+
+    for (int shift = 0; shift < 32; shift += 8) {
+        unsigned int a = (from >> shift) & 0xFF;
+        unsigned int b = (to >> shift) & 0xFF;
+
+        colour |= ((a * (255 - level) + b * level + 127) / 255) << shift;
+    }
+
+    return colour;
+}
+
+// Scanline brightness on R, G and B; alpha is left alone
+static uint32_t dim_colour(uint32_t colour) {
+    uint32_t dimmed = colour & 0xFF;
+
+    for (int shift = 8; shift < 32; shift += 8) dimmed |= ((((colour >> shift) & 0xFF) * SCANLINE_LEVEL) >> 8) << shift;
+
+    return dimmed;
+}
+
+static uint8_t next_level(const struct Presenter *presenter, bool lit, uint8_t level) {
+    return lit ? 255 : (level * presenter->persistence) >> 8;
+}
+
+static void colourise_scalar(struct Presenter *presenter, uint64_t line, uint8_t *levels, uint32_t *colours, uint32_t *dim_colours) {
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        uint8_t level = next_level(presenter, (line >> (SCREEN_WIDTH - 1 - x)) & 1, levels[x]);
+
+        levels[x] = level;
+        colours[x] = presenter->ramp[level];
+        if (dim_colours != NULL) dim_colours[x] = presenter->dim_ramp[level];
+    }
+}
+
+static void widen_scalar(const uint32_t *colours, uint32_t *out, int scale) {
+    if (scale == 1) {
+        memcpy(out, colours, SCREEN_WIDTH * sizeof(uint32_t));
+        return;
+    }
+
+    for (int x = 0; x < SCREEN_WIDTH; x++) {
+        for (int k = 0; k < scale; k++) *out++ = colours[x];
+    }
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+// Eight pixels at a time, in 16-bit lanes: levels decay with one multiply, and
+// without persistence the colours are a select between the two ramp ends
+__attribute__((target("sse2")))
+static void colourise_sse2(struct Presenter *presenter, uint64_t line, uint8_t *levels, uint32_t *colours, uint32_t *dim_colours) {
+    const __m128i bit = _mm_set_epi16(1, 2, 4, 8, 16, 32, 64, 128); // Lane 0 is the leftmost pixel
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i persistence = _mm_set1_epi16(presenter->persistence);
+
+    for (int x = 0; x < SCREEN_WIDTH; x += 8) {
+        __m128i bits = _mm_set1_epi16((line >> (SCREEN_WIDTH - 8 - x)) & 0xFF);
+        __m128i lit = _mm_cmpeq_epi16(_mm_and_si128(bits, bit), bit);
+        __m128i old = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(levels + x)), zero);
+        __m128i decayed = _mm_srli_epi16(_mm_mullo_epi16(old, persistence), 8);
+        __m128i level = _mm_or_si128(_mm_and_si128(lit, full), _mm_andnot_si128(lit, decayed));
+
+        _mm_storel_epi64((__m128i *)(levels + x), _mm_packus_epi16(level, level));
+
+        if (presenter->persistence != 0) continue; // Colours come from the ramp below
+
+        __m128i lit_lo = _mm_unpacklo_epi16(lit, lit);
+        __m128i lit_hi = _mm_unpackhi_epi16(lit, lit);
+        __m128i fg = _mm_set1_epi32(presenter->ramp[255]);
+        __m128i bg = _mm_set1_epi32(presenter->ramp[0]);
+
+        _mm_storeu_si128((__m128i *)(colours + x), _mm_or_si128(_mm_and_si128(lit_lo, fg), _mm_andnot_si128(lit_lo, bg)));
+        _mm_storeu_si128((__m128i *)(colours + x + 4), _mm_or_si128(_mm_and_si128(lit_hi, fg), _mm_andnot_si128(lit_hi, bg)));
+
+        if (dim_colours == NULL) continue;
+
+        fg = _mm_set1_epi32(presenter->dim_ramp[255]);
+        bg = _mm_set1_epi32(presenter->dim_ramp[0]);
+
+        _mm_storeu_si128((__m128i *)(dim_colours + x), _mm_or_si128(_mm_and_si128(lit_lo, fg), _mm_andnot_si128(lit_lo, bg)));
+        _mm_storeu_si128((__m128i *)(dim_colours + x + 4), _mm_or_si128(_mm_and_si128(lit_hi, fg), _mm_andnot_si128(lit_hi, bg)));
+    }
+
+    // SSE2 has no gather
+    if (presenter->persistence != 0) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            colours[x] = presenter->ramp[levels[x]];
+            if (dim_colours != NULL) dim_colours[x] = presenter->dim_ramp[levels[x]];
+        }
+    }
+}
+
+// Each pixel stores its colour in whole vectors; a store running past the
+// pixel's cell is overwritten by the next pixel, and the last pixel finishes
+// with scalar stores so nothing lands beyond the row
+__attribute__((target("sse2")))
+static void widen_sse2(const uint32_t *colours, uint32_t *out, int scale) {
+    if (scale == 1) {
+        memcpy(out, colours, SCREEN_WIDTH * sizeof(uint32_t));
+        return;
+    }
+
+    if (scale == 2) {
+        for (int x = 0; x < SCREEN_WIDTH; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(colours + x));
+
+            _mm_storeu_si128((__m128i *)(out + 2 * x), _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i *)(out + 2 * x + 4), _mm_unpackhi_epi32(v, v));
+        }
+
+        return;
+    }
+
+    for (int x = 0; x < SCREEN_WIDTH - 1; x++) {
+        __m128i v = _mm_set1_epi32(colours[x]);
+        uint32_t *cell = out + x * scale;
+
+        for (int k = 0; k < scale; k += 4) _mm_storeu_si128((__m128i *)(cell + k), v);
+    }
+
+    uint32_t *cell = out + (SCREEN_WIDTH - 1) * scale;
+    uint32_t colour = colours[SCREEN_WIDTH - 1];
+    int k = 0;
+
+    for (; k + 4 <= scale; k += 4) _mm_storeu_si128((__m128i *)(cell + k), _mm_set1_epi32(colour));
+    for (; k < scale; k++) cell[k] = colour;
+}
+
+// Eight pixels at a time in 32-bit lanes; with persistence the colours are gathered from the ramp
+__attribute__((target("avx2")))
+static void colourise_avx2(struct Presenter *presenter, uint64_t line, uint8_t *levels, uint32_t *colours, uint32_t *dim_colours) {
+    const __m256i bit = _mm256_setr_epi32(128, 64, 32, 16, 8, 4, 2, 1); // Lane 0 is the leftmost pixel
+    const __m256i full = _mm256_set1_epi32(255);
+    const __m256i persistence = _mm256_set1_epi32(presenter->persistence);
+    const __m256i pack = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+    const __m256i fg = _mm256_set1_epi32(presenter->ramp[255]);
+    const __m256i bg = _mm256_set1_epi32(presenter->ramp[0]);
+    const __m256i dim_fg = _mm256_set1_epi32(presenter->dim_ramp[255]);
+    const __m256i dim_bg = _mm256_set1_epi32(presenter->dim_ramp[0]);
+
+    for (int x = 0; x < SCREEN_WIDTH; x += 8) {
+        __m256i bits = _mm256_set1_epi32((line >> (SCREEN_WIDTH - 8 - x)) & 0xFF);
+        __m256i lit = _mm256_cmpeq_epi32(_mm256_and_si256(bits, bit), bit);
+
+        if (presenter->persistence == 0) {
+            _mm_storel_epi64((__m128i *)(levels + x), _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(
+                _mm256_packus_epi16(_mm256_packus_epi32(_mm256_and_si256(lit, full), full), full), pack)));
+            _mm256_storeu_si256((__m256i *)(colours + x), _mm256_blendv_epi8(bg, fg, lit));
+            if (dim_colours != NULL) _mm256_storeu_si256((__m256i *)(dim_colours + x), _mm256_blendv_epi8(dim_bg, dim_fg, lit));
+            continue;
+        }
+
+        __m256i old = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(levels + x)));
+        __m256i decayed = _mm256_srli_epi32(_mm256_mullo_epi32(old, persistence), 8);
+        __m256i level = _mm256_blendv_epi8(decayed, full, lit);
+
+        // 32-bit lanes back to eight bytes: pack twice, then pull the two 128-bit halves' first dwords together
+        __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(level, level), full);
+
+        _mm_storel_epi64((__m128i *)(levels + x), _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(bytes, pack)));
+        _mm256_storeu_si256((__m256i *)(colours + x), _mm256_i32gather_epi32((const int *)presenter->ramp, level, 4));
+
+        if (dim_colours != NULL) {
+            _mm256_storeu_si256((__m256i *)(dim_colours + x), _mm256_i32gather_epi32((const int *)presenter->dim_ramp, level, 4));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static void widen_avx2(const uint32_t *colours, uint32_t *out, int scale) {
+    if (scale == 1) {
+        memcpy(out, colours, SCREEN_WIDTH * sizeof(uint32_t));
+        return;
+    }
+
+    if (scale == 2) {
+        for (int x = 0; x < SCREEN_WIDTH; x += 8) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(colours + x));
+            __m256i lo = _mm256_unpacklo_epi32(v, v); // c0 c0 c1 c1 | c4 c4 c5 c5
+            __m256i hi = _mm256_unpackhi_epi32(v, v); // c2 c2 c3 c3 | c6 c6 c7 c7
+
+            _mm256_storeu_si256((__m256i *)(out + 2 * x), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i *)(out + 2 * x + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+        }
+
+        return;
+    }
+
+    // As widen_sse2(), a whole vector per store
+    for (int x = 0; x < SCREEN_WIDTH - 1; x++) {
+        __m256i v = _mm256_set1_epi32(colours[x]);
+        uint32_t *cell = out + x * scale;
+
+        for (int k = 0; k < scale; k += 8) _mm256_storeu_si256((__m256i *)(cell + k), v);
+    }
+
+    uint32_t *cell = out + (SCREEN_WIDTH - 1) * scale;
+    uint32_t colour = colours[SCREEN_WIDTH - 1];
+    int k = 0;
+
+    for (; k + 8 <= scale; k += 8) _mm256_storeu_si256((__m256i *)(cell + k), _mm256_set1_epi32(colour));
+    for (; k < scale; k++) cell[k] = colour;
+}
+#endif
+
+bool set_presenter_target(struct Presenter *presenter, const char *target) {
+    if (strcmp(target, "scalar") == 0) {
+        presenter->colourise = &colourise_scalar;
+        presenter->widen = &widen_scalar;
+        presenter->target = "scalar";
+        return true;
+    }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (strcmp(target, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        presenter->colourise = &colourise_sse2;
+        presenter->widen = &widen_sse2;
+        presenter->target = "sse2";
+        return true;
+    }
+
+    if (strcmp(target, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        presenter->colourise = &colourise_avx2;
+        presenter->widen = &widen_avx2;
+        presenter->target = "avx2";
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+void initialise_presenter(struct Presenter *presenter, int scale, uint32_t foreground, uint32_t background,
+                          bool scanlines, uint8_t persistence) {
+    if (scale < 1 || scale > MAX_VIDEO_SCALE) error("Video scale out of range", true);
+
+    presenter->scale = scale;
+    presenter->scanlines = scanlines;
+    presenter->persistence = persistence;
+
+    for (int level = 0; level < 256; level++) {
+        presenter->ramp[level] = mix_colour(background, foreground, level);
+        presenter->dim_ramp[level] = dim_colour(presenter->ramp[level]);
+    }
+
+    memset(presenter->levels, 0, sizeof(presenter->levels));
+    presenter->fading = false;
+
+    if (!set_presenter_target(presenter, "avx2") && !set_presenter_target(presenter, "sse2")) {
+        set_presenter_target(presenter, "scalar");
+    }
+}
+
+bool present_display(struct Presenter *presenter, const uint64_t *display, void *pixels, int pitch) {
+    uint32_t colours[SCREEN_WIDTH];
+    uint32_t dim_colours[SCREEN_WIDTH];
+    int scale = presenter->scale;
+    bool scanlines = presenter->scanlines && scale >= 2;
+    int plain_rows = scanlines ? scale - 1 : scale;
+    size_t row_bytes = SCREEN_WIDTH * scale * sizeof(uint32_t);
+
+    for (int y = 0; y < SCREEN_HEIGHT; y++) {
+        uint8_t *cell = (uint8_t *)pixels + (size_t)y * scale * pitch;
+
+        presenter->colourise(presenter, display[y], presenter->levels + y * SCREEN_WIDTH, colours, scanlines ? dim_colours : NULL);
+        presenter->widen(colours, (uint32_t *)cell, scale);
+
+        for (int r = 1; r < plain_rows; r++) memcpy(cell + (size_t)r * pitch, cell, row_bytes);
+
+        if (scanlines) presenter->widen(dim_colours, (uint32_t *)(cell + (size_t)(scale - 1) * pitch), scale);
+    }
+
+    presenter->fading = false;
+
+    if (presenter->persistence != 0) {
+        for (int i = 0; i < SCREEN_SIZE && !presenter->fading; i++) {
+            presenter->fading = presenter->levels[i] != 0 && presenter->levels[i] != 255;
+        }
+    }
+
+    return presenter->fading;
+}
@@ -0,0 +1,46 @@
+#ifndef PRESENT_H
+#define PRESENT_H
+
+#include "chip8.h"
+
+// CPU presentation: expands the 1bpp display straight into a 32-bit texture at
+// an integer scale, colouring it with a foreground/background ramp. Optional
+// scanlines darken the last row of every scaled pixel, and optional phosphor
+// persistence lets switched-off pixels fade out over a few frames, which hides
+// the flicker of XOR-drawn sprites. Colours are 0xRRGGBBAA (SDL RGBA8888).
+//
+// Each display row is coloured once into SCREEN_WIDTH colours, widened into the
+// first texture row of its cell, and that row is copied down the cell; the
+// colour and widening kernels are SSE2 or AVX2 where the host has them.
+
+#define MAX_VIDEO_SCALE 64
+#define SCANLINE_LEVEL 160 // Scanline brightness out of 256
+
+struct Presenter {
+    int scale;
+    bool scanlines;
+    uint8_t persistence; // Per frame, a dark pixel keeps this/256 of its glow; 0 = none
+
+    uint32_t ramp[256];     // Colour per glow level, background (0) to foreground (255)
+    uint32_t dim_ramp[256]; // The same at scanline brightness
+    uint8_t levels[SCREEN_SIZE]; // Glow per display pixel
+    bool fading;                 // Some pixel is still between levels
+
+    // Kernels picked for this host
+    void (*colourise)(struct Presenter *presenter, uint64_t line, uint8_t *levels, uint32_t *colours, uint32_t *dim_colours);
+    void (*widen)(const uint32_t *colours, uint32_t *out, int scale);
+    const char *target; // "avx2", "sse2" or "scalar"
+};
+
+void initialise_presenter(struct Presenter *presenter, int scale, uint32_t foreground, uint32_t background,
+                          bool scanlines, uint8_t persistence);
+
+// For benchmarks: forces "avx2", "sse2" or "scalar"; false if this host can't run it
+bool set_presenter_target(struct Presenter *presenter, const char *target);
+
+// Writes SCREEN_WIDTH * scale by SCREEN_HEIGHT * scale pixels; pitch is in bytes.
+// With persistence, returns true while pixels are still fading, i.e. presenting
+// the same display again would change the picture.
+bool present_display(struct Presenter *presenter, const uint64_t *display, void *pixels, int pitch);
+
+#endif
@@ -0,0 +1,255 @@
+#include "profile.h"
+
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICK_UNIT "TSC ticks"
+static inline uint64_t profile_ticks() {
+    return __rdtsc();
+}
+#else
+#define TICK_UNIT "ns"
+static inline uint64_t profile_ticks() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+#define STACK_HASH_SIZE (PROFILE_MAX_STACKS * 2) // Power of two, kept at most half full
+#define NO_STACK 0xFFFFFFFF
+
+// One node per distinct call path: `addr` is the subroutine entered from `parent`
+struct StackNode {
+    uint32_t parent;
+    uint16_t addr;
+    uint64_t samples; // Instructions executed with this exact stack
+};
+
+struct Profile {
+    uint64_t instructions;
+    uint64_t opcode_counts[0x10000];
+    uint64_t pc_counts[MEMORY_SIZE];
+
+    uint64_t draw_calls[16]; // By sprite height (N)
+    uint64_t draw_ticks[16];
+
+    // Shadow call stack, driven by SP changes
+    struct StackNode stacks[PROFILE_MAX_STACKS];
+    uint32_t stack_count;
+    uint32_t stack_slots[STACK_HASH_SIZE]; // Node index, keyed on (parent, addr)
+    uint32_t current;
+    uint32_t untracked_depth; // Calls made once the node table was full
+};
+
+struct Profile *create_profile() {
+    struct Profile *profile = (struct Profile *)calloc(1, sizeof(struct Profile));
+
+    if (profile == NULL) error("Failed to allocate profile", true);
+
+    memset(profile->stack_slots, 0xFF, sizeof(profile->stack_slots));
+
+    // Node 0 is the top level, entered at the ROM start
+    profile->stacks[0].parent = NO_STACK;
+    profile->stacks[0].addr = ROM_START_ADDR;
+    profile->stack_count = 1;
+
+    return profile;
+}
+
+void destroy_profile(struct Profile *profile) {
+    free(profile);
+}
+
+static void enter_subroutine(struct Profile *profile, uint16_t addr) {
+    // Below an untracked frame, `current` is not the caller, so no node can match
+    if (profile->untracked_depth > 0) {
+        profile->untracked_depth++;
+        return;
+    }
+
+    uint32_t slot = (profile->current * 0x9E3779B1u ^ addr) & (STACK_HASH_SIZE - 1);
+
+    while (profile->stack_slots[slot] != NO_STACK) {
+        struct StackNode *node = &profile->stacks[profile->stack_slots[slot]];
+
+        if (node->parent == profile->current && node->addr == addr) {
+            profile->current = profile->stack_slots[slot];
+            return;
+        }
+
+        slot = (slot + 1) & (STACK_HASH_SIZE - 1);
+    }
+
+    if (profile->stack_count == PROFILE_MAX_STACKS) {
+        profile->untracked_depth++;
+        return;
+    }
+
+    struct StackNode *node = &profile->stacks[profile->stack_count];
+    node->parent = profile->current;
+    node->addr = addr;
+    node->samples = 0;
+
+    profile->stack_slots[slot] = profile->stack_count;
+    profile->current = profile->stack_count++;
+}
+
+static void leave_subroutine(struct Profile *profile) {
+    if (profile->untracked_depth > 0) {
+        profile->untracked_depth--;
+    } else if (profile->stacks[profile->current].parent != NO_STACK) {
+        profile->current = profile->stacks[profile->current].parent;
+    }
+}
+
+static void profile_cycle(struct Profile *profile, struct Chip8 *state) {
+    uint16_t pc = state->pc & (MEMORY_SIZE - 1);
+    uint8_t sp = state->sp;
+
+    profile->pc_counts[pc]++;
+    profile->stacks[profile->current].samples++;
+
+    if ((state->memory[pc] & 0xF0) == 0xD0) {
+        uint8_t height = pc + 1 < MEMORY_SIZE ? state->memory[pc + 1] & 0x0F : 0;
+        uint64_t start = profile_ticks();
+
+        cycle(state);
+
+        profile->draw_ticks[height] += profile_ticks() - start;
+        profile->draw_calls[height]++;
+    } else {
+        cycle(state);
+    }
+
+    profile->opcode_counts[state->opcode]++;
+    profile->instructions++;
+
+    // 2NNN raises SP and lands on the callee; 00EE lowers it
+    if (state->sp == (uint8_t)(sp + 1)) enter_subroutine(profile, state->pc);
+    else if (state->sp == (uint8_t)(sp - 1)) leave_subroutine(profile);
+}
+
+void run_cycles_profiled(struct Profile *profile, struct Chip8 *state, uint64_t count) {
+    uint64_t end = state->cycles + count;
+
+    while (state->cycles < end) {
+        update_run_stop(state, end);
+
+        while (state->cycles < state->run_stop) profile_cycle(profile, state);
+
+        dispatch_events(state);
+    }
+}
+
+//
+// Reporting
+//
+
+struct Ranked {
+    const char *name;
+    uint32_t key;
+    uint64_t count;
+};
+
+static int compare_ranked(const void *a, const void *b) {
+    uint64_t x = ((const struct Ranked *)a)->count;
+    uint64_t y = ((const struct Ranked *)b)->count;
+
+    return (x < y) - (x > y); // Descending
+}
+
+static double percent(uint64_t count, uint64_t total) {
+    return total > 0 ? 100.0 * count / total : 0.0;
+}
+
+void write_profile_report(const struct Profile *profile, const struct Chip8 *state, FILE *out) {
+    struct Ranked handlers[64];
+    int handler_count = 0;
+
+    // Fold opcode counts into their handlers
+    for (uint32_t opcode = 0; opcode <= 0xFFFF; opcode++) {
+        if (profile->opcode_counts[opcode] == 0) continue;
+
+        const char *name = handler_name(decode_table[opcode].execute);
+        int i = 0;
+
+        while (i < handler_count && handlers[i].name != name) i++;
+
+        if (i == handler_count) {
+            handlers[handler_count].name = name;
+            handlers[handler_count].count = 0;
+            handler_count++;
+        }
+
+        handlers[i].count += profile->opcode_counts[opcode];
+    }
+
+    qsort(handlers, handler_count, sizeof(struct Ranked), compare_ranked);
+
+    fprintf(out, "profile: %llu instructions executed\n\n", (unsigned long long)profile->instructions);
+    fprintf(out, "handler       count        share\n");
+
+    for (int i = 0; i < handler_count; i++) {
+        fprintf(out, "%-12s %12llu  %6.2f%%\n", handlers[i].name,
+                (unsigned long long)handlers[i].count, percent(handlers[i].count, profile->instructions));
+    }
+
+    static struct Ranked pcs[MEMORY_SIZE];
+    int pc_count = 0;
+
+    for (uint32_t pc = 0; pc < MEMORY_SIZE; pc++) {
+        if (profile->pc_counts[pc] == 0) continue;
+
+        pcs[pc_count].key = pc;
+        pcs[pc_count].count = profile->pc_counts[pc];
+        pc_count++;
+    }
+
+    qsort(pcs, pc_count, sizeof(struct Ranked), compare_ranked);
+
+    fprintf(out, "\npc   opcode  handler       count        share\n");
+
+    for (int i = 0; i < pc_count && i < PROFILE_TOP_PCS; i++) {
+        uint16_t pc = pcs[i].key;
+        uint16_t opcode = pc + 1 < MEMORY_SIZE ? (state->memory[pc] << 8) | state->memory[pc + 1] : 0;
+
+        // Opcode as memory holds it now; self-modifying code may have run something else
+        fprintf(out, "%03X  %04X    %-12s %12llu  %6.2f%%\n", pc, opcode, handler_name(decode_table[opcode].execute),
+                (unsigned long long)pcs[i].count, percent(pcs[i].count, profile->instructions));
+    }
+
+    fprintf(out, "\nDXYN by height  calls        %s/call\n", TICK_UNIT);
+
+    for (int n = 0; n < 16; n++) {
+        if (profile->draw_calls[n] == 0) continue;
+
+        fprintf(out, "N=%-2d           %12llu %10.1f\n", n, (unsigned long long)profile->draw_calls[n],
+                (double)profile->draw_ticks[n] / profile->draw_calls[n]);
+    }
+}
+
+bool write_folded_stacks(const struct Profile *profile, const char *filename) {
+    FILE *fp = fopen(filename, "w");
+
+    if (fp == NULL) return false;
+
+    for (uint32_t i = 0; i < profile->stack_count; i++) {
+        if (profile->stacks[i].samples == 0) continue;
+
+        // Walk to the root, then print outermost first
+        uint16_t path[PROFILE_MAX_STACKS];
+        int depth = 0;
+
+        for (uint32_t node = i; node != 0; node = profile->stacks[node].parent) path[depth++] = profile->stacks[node].addr;
+
+        fprintf(fp, "main");
+        while (depth > 0) fprintf(fp, ";sub_%03X", path[--depth]);
+        fprintf(fp, " %llu\n", (unsigned long long)profile->stacks[i].samples);
+    }
+
+    fclose(fp);
+    return true;
+}
@@ -0,0 +1,27 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "chip8.h"
+
+// Opt-in execution profiler. A profiled run steps through run_cycles_profiled(),
+// a separate copy of the step loop, so cycle() and run_cycles() carry no
+// profiling code at all when it is off. Idle-skipped instructions are not counted.
+
+#define PROFILE_MAX_STACKS 4096 // Distinct call stacks tracked; deeper novelty folds into the caller
+#define PROFILE_TOP_PCS 20      // Hot addresses listed in the report
+
+struct Profile;
+
+struct Profile *create_profile();
+void destroy_profile(struct Profile *profile);
+
+// run_cycles(), counting every instruction by opcode, PC and call stack
+void run_cycles_profiled(struct Profile *profile, struct Chip8 *state, uint64_t count);
+
+// Handlers and hot PCs sorted by count, plus DXYN cost by sprite height
+void write_profile_report(const struct Profile *profile, const struct Chip8 *state, FILE *out);
+
+// One "main;sub_2A0;sub_31C count" line per call stack, for flamegraph.pl
+bool write_folded_stacks(const struct Profile *profile, const char *filename);
+
+#endif
@@ -0,0 +1,197 @@
+#include "rewind.h"
+
+#include <string.h>
+
+#define BODY_WORDS (sizeof(struct SavestateBody) / sizeof(uint64_t))
+
+_Static_assert(sizeof(struct SavestateBody) % sizeof(uint64_t) == 0, "savestate body must be whole words");
+
+// A delta is a list of runs of changed words, each a RunHeader followed by
+// `count` words of (older XOR newer)
+struct RunHeader {
+    uint16_t offset; // In words
+    uint16_t count;
+};
+
+// Worst case: every other word changed, one run per word
+#define MAX_DELTA_BYTES (BODY_WORDS * (sizeof(struct RunHeader) + sizeof(uint64_t)))
+
+struct Rewind {
+    uint8_t *ring;
+    size_t ring_size;
+    size_t head; // Where the next delta starts
+    size_t used;
+
+    // Delta positions, oldest first, in a ring of their own
+    uint32_t *offsets;
+    uint32_t *sizes;
+    size_t max_entries;
+    size_t first;
+    size_t count;
+
+    bool have_newest;
+    struct SavestateBody newest;
+    struct SavestateBody capture;
+    uint8_t scratch[MAX_DELTA_BYTES];
+};
+
+struct Rewind *create_rewind(size_t buffer_bytes) {
+    struct Rewind *rewind = (struct Rewind *)calloc(1, sizeof(struct Rewind));
+
+    if (rewind == NULL) error("Failed to allocate rewind buffer", true);
+
+    if (buffer_bytes > UINT32_MAX) error("Rewind buffer too large", true);
+
+    // Smallest delta is one run of one word, but a tiny delta per frame would
+    // need an index as big as the ring, so history is capped in frames too
+    rewind->max_entries = buffer_bytes / (sizeof(struct RunHeader) + sizeof(uint64_t)) + 1;
+    if (rewind->max_entries > MAX_REWIND_FRAMES) rewind->max_entries = MAX_REWIND_FRAMES;
+
+    rewind->ring = (uint8_t *)malloc(buffer_bytes);
+    rewind->offsets = (uint32_t *)malloc(rewind->max_entries * sizeof(uint32_t));
+    rewind->sizes = (uint32_t *)malloc(rewind->max_entries * sizeof(uint32_t));
+    rewind->ring_size = buffer_bytes;
+
+    if (rewind->ring == NULL || rewind->offsets == NULL || rewind->sizes == NULL) error("Failed to allocate rewind buffer", true);
+
+    return rewind;
+}
+
+void destroy_rewind(struct Rewind *rewind) {
+    free(rewind->ring);
+    free(rewind->offsets);
+    free(rewind->sizes);
+    free(rewind);
+}
+
+size_t rewind_frames(const struct Rewind *rewind) {
+    return rewind->count;
+}
+
+size_t rewind_bytes_used(const struct Rewind *rewind) {
+    return rewind->used + (rewind->have_newest ? sizeof(struct SavestateBody) : 0);
+}
+
+// Encodes older ^ newer into scratch, returns its size
+static size_t encode_delta(uint8_t *out, const uint64_t *older, const uint64_t *newer) {
+    size_t size = 0;
+    size_t i = 0;
+
+    while (i < BODY_WORDS) {
+        if (older[i] == newer[i]) {
+            i++;
+            continue;
+        }
+
+        struct RunHeader run = { (uint16_t)i, 0 };
+        size_t header_at = size;
+        size += sizeof(run);
+
+        for (; i < BODY_WORDS && older[i] != newer[i]; i++) {
+            uint64_t x = older[i] ^ newer[i];
+
+            memcpy(out + size, &x, sizeof(x));
+            size += sizeof(x);
+            run.count++;
+        }
+
+        memcpy(out + header_at, &run, sizeof(run));
+    }
+
+    return size;
+}
+
+static void apply_delta(uint64_t *body, const uint8_t *delta, size_t size) {
+    size_t at = 0;
+
+    while (at < size) {
+        struct RunHeader run;
+
+        memcpy(&run, delta + at, sizeof(run));
+        at += sizeof(run);
+
+        for (uint16_t i = 0; i < run.count; i++) {
+            uint64_t x;
+
+            memcpy(&x, delta + at, sizeof(x));
+            body[run.offset + i] ^= x;
+            at += sizeof(x);
+        }
+    }
+}
+
+// Byte-ring copies that wrap at the end of the buffer
+static void ring_write(struct Rewind *rewind, size_t offset, const uint8_t *data, size_t size) {
+    size_t tail = rewind->ring_size - offset;
+
+    if (size <= tail) {
+        memcpy(rewind->ring + offset, data, size);
+    } else {
+        memcpy(rewind->ring + offset, data, tail);
+        memcpy(rewind->ring, data + tail, size - tail);
+    }
+}
+
+static void ring_read(const struct Rewind *rewind, size_t offset, uint8_t *data, size_t size) {
+    size_t tail = rewind->ring_size - offset;
+
+    if (size <= tail) {
+        memcpy(data, rewind->ring + offset, size);
+    } else {
+        memcpy(data, rewind->ring + offset, tail);
+        memcpy(data + tail, rewind->ring, size - tail);
+    }
+}
+
+static void drop_oldest(struct Rewind *rewind) {
+    rewind->used -= rewind->sizes[rewind->first];
+    rewind->first = (rewind->first + 1) % rewind->max_entries;
+    rewind->count--;
+}
+
+void rewind_capture(struct Rewind *rewind, const struct Chip8 *state) {
+    save_state_body(state, &rewind->capture);
+
+    if (rewind->have_newest) {
+        size_t size = encode_delta(rewind->scratch, (const uint64_t *)&rewind->newest, (const uint64_t *)&rewind->capture);
+
+        if (size > rewind->ring_size) {
+            // Ring too small for even one step: history restarts here
+            while (rewind->count > 0) drop_oldest(rewind);
+        } else {
+            while (rewind->count > 0 && (rewind->ring_size - rewind->used < size || rewind->count == rewind->max_entries)) {
+                drop_oldest(rewind);
+            }
+
+            size_t entry = (rewind->first + rewind->count) % rewind->max_entries;
+
+            ring_write(rewind, rewind->head, rewind->scratch, size);
+            rewind->offsets[entry] = (uint32_t)rewind->head;
+            rewind->sizes[entry] = (uint32_t)size;
+            rewind->count++;
+
+            rewind->head = (rewind->head + size) % rewind->ring_size;
+            rewind->used += size;
+        }
+    }
+
+    rewind->newest = rewind->capture;
+    rewind->have_newest = true;
+}
+
+bool rewind_step_back(struct Rewind *rewind, struct Chip8 *state) {
+    if (rewind->count == 0) return false;
+
+    size_t entry = (rewind->first + rewind->count - 1) % rewind->max_entries;
+    size_t size = rewind->sizes[entry];
+
+    ring_read(rewind, rewind->offsets[entry], rewind->scratch, size);
+    apply_delta((uint64_t *)&rewind->newest, rewind->scratch, size);
+
+    rewind->head = rewind->offsets[entry];
+    rewind->used -= size;
+    rewind->count--;
+
+    restore_state_body(state, &rewind->newest);
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "savestate.h"
+
+// Rewind history: one capture per frame in a fixed-size byte ring. Only the
+// newest capture is kept whole; every older one is a sparse XOR delta against
+// its successor, so stepping back is one delta applied in place, and the
+// oldest history is dropped for free when the ring fills.
+
+#define DEFAULT_REWIND_BYTES (4 << 20)
+#define MAX_REWIND_FRAMES (5 * 60 * 60) // Five minutes at 60 captures a second
+
+struct Rewind;
+
+struct Rewind *create_rewind(size_t buffer_bytes);
+void destroy_rewind(struct Rewind *rewind);
+
+void rewind_capture(struct Rewind *rewind, const struct Chip8 *state); // Call once per frame
+
+// Restores the capture before the newest one and makes it the newest;
+// returns false once history is exhausted
+bool rewind_step_back(struct Rewind *rewind, struct Chip8 *state);
+
+size_t rewind_frames(const struct Rewind *rewind); // Steps back available
+size_t rewind_bytes_used(const struct Rewind *rewind);
+
+#endif
@@ -0,0 +1,256 @@
+#include "savestate.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+_Static_assert(sizeof(struct SavestateHeader) == 16, "savestate header layout changed");
+_Static_assert(sizeof(struct SavestateBody) == 4456, "savestate v2 body layout changed");
+
+#define RESTORE_CHUNK 64 // Memory is compared and copied in chunks this size
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void fill_crc_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0x82F63B78 ^ (c >> 1) : c >> 1;
+
+        crc_table[0][i] = c;
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xFF] ^ (crc_table[t - 1][i] >> 8);
+    }
+}
+
+// Slicing-by-8: one table lookup per byte, eight bytes per step
+static uint32_t crc32c_table(uint32_t c, const uint8_t *p, size_t size) {
+    pthread_once(&crc_table_once, fill_crc_table);
+
+    for (; size >= 8; p += 8, size -= 8) {
+        uint32_t lo;
+        uint32_t hi;
+
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= c;
+
+        c = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^
+            crc_table[5][(lo >> 16) & 0xFF] ^ crc_table[4][lo >> 24] ^
+            crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+            crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+    }
+
+    while (size-- > 0) c = crc_table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+
+    return c;
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t c, const uint8_t *p, size_t size) {
+    uint64_t c64 = c;
+
+    for (; size >= 8; p += 8, size -= 8) {
+        uint64_t word;
+
+        memcpy(&word, p, 8);
+        c64 = _mm_crc32_u64(c64, word);
+    }
+
+    c = (uint32_t)c64;
+    while (size-- > 0) c = _mm_crc32_u8(c, *p++);
+
+    return c;
+}
+#endif
+
+// CRC-32C (Castagnoli): the SSE4.2 crc32 instruction where the CPU has it, else tables
+uint32_t crc32c(const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t *)data;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (__builtin_cpu_supports("sse4.2")) return crc32c_sse42(0xFFFFFFFF, p, size) ^ 0xFFFFFFFF;
+#endif
+
+    return crc32c_table(0xFFFFFFFF, p, size) ^ 0xFFFFFFFF;
+}
+
+void save_state_body(const struct Chip8 *state, struct SavestateBody *body) {
+    memset(body, 0, sizeof(*body));
+
+    body->cycles = state->cycles;
+    body->delay_expiry = state->delay_expiry;
+    body->sound_expiry = state->sound_expiry;
+    memcpy(body->display, state->display, sizeof(body->display));
+
+    memcpy(body->stack, state->stack, sizeof(body->stack));
+    body->index = state->index;
+    body->pc = state->pc;
+    body->opcode = state->opcode;
+
+    body->keypad = keypad_mask(state);
+
+    body->cycles_per_frame = state->cycles_per_frame;
+    body->rng_state = state->rng_state;
+
+    memcpy(body->registers, state->registers, sizeof(body->registers));
+    body->sp = state->sp;
+
+    memcpy(body->memory, state->memory, sizeof(body->memory));
+}
+
+void save_state(const struct Chip8 *state, void *buffer) {
+    struct SavestateHeader *header = (struct SavestateHeader *)buffer;
+    struct SavestateBody *body = (struct SavestateBody *)(header + 1);
+
+    save_state_body(state, body);
+
+    header->magic = SAVESTATE_MAGIC;
+    header->version = SAVESTATE_VERSION;
+    header->header_size = sizeof(struct SavestateHeader);
+    header->body_size = sizeof(struct SavestateBody);
+    header->crc32c = crc32c(body, sizeof(*body));
+}
+
+// Copies only the chunks that differ, dropping cached decodes that overlap them
+static void restore_memory(struct Chip8 *state, const uint8_t *memory) {
+    for (int base = 0; base < MEMORY_SIZE; base += RESTORE_CHUNK) {
+        if (memcmp(state->memory + base, memory + base, RESTORE_CHUNK) == 0) continue;
+
+        unshare_memory(state);
+        memcpy(state->memory + base, memory + base, RESTORE_CHUNK);
+
+        // The instruction straddling the chunk's first byte is stale too
+        int first = base > 0 ? base - 1 : 0;
+        memset(&state->icache[first], 0, (base + RESTORE_CHUNK - first) * sizeof(state->icache[0]));
+
+        state->code_written = true;
+    }
+}
+
+bool restore_state(struct Chip8 *state, const void *buffer, size_t size) {
+    const struct SavestateHeader *header = (const struct SavestateHeader *)buffer;
+    const struct SavestateBody *body = (const struct SavestateBody *)(header + 1);
+
+    if (size < SAVESTATE_SIZE || header->magic != SAVESTATE_MAGIC) {
+        error("Not a save state", false);
+        return false;
+    }
+
+    if (header->version != SAVESTATE_VERSION || header->header_size != sizeof(struct SavestateHeader) ||
+        header->body_size != sizeof(struct SavestateBody)) {
+        error("Unsupported save state version", false);
+        return false;
+    }
+
+    if (crc32c(body, sizeof(*body)) != header->crc32c) {
+        error("Save state checksum mismatch", false);
+        return false;
+    }
+
+    if (body->cycles_per_frame == 0) {
+        error("Save state is inconsistent", false);
+        return false;
+    }
+
+    restore_state_body(state, body);
+    return true;
+}
+
+void restore_state_body(struct Chip8 *state, const struct SavestateBody *body) {
+    state->cycles = body->cycles;
+    state->delay_expiry = body->delay_expiry;
+    state->sound_expiry = body->sound_expiry;
+
+    memcpy(state->display, body->display, sizeof(state->display));
+    state->display_generation++;
+
+    memcpy(state->stack, body->stack, sizeof(state->stack));
+    state->index = body->index;
+    state->pc = body->pc;
+    state->opcode = body->opcode;
+
+    set_keypad_mask(state, body->keypad);
+
+    state->cycles_per_frame = body->cycles_per_frame;
+    state->rng_state = body->rng_state;
+
+    memcpy(state->registers, body->registers, sizeof(state->registers));
+    state->sp = body->sp;
+
+    restore_memory(state, body->memory);
+
+    // Faults are diagnostics for the run since the snapshot, not machine state
+    state->faults = 0;
+    memset(state->fault_pc, 0, sizeof(state->fault_pc));
+
+    // Pending events follow from the timers; edges already reported are not repeated
+    uint64_t tick = current_tick(state);
+    state->event_count = 0;
+
+    if (state->delay_expiry > tick) {
+        schedule_event(state, state->delay_expiry * state->cycles_per_frame, EVENT_DELAY_EXPIRED);
+    }
+
+    if (state->sound_expiry > tick) {
+        schedule_event(state, state->sound_expiry * state->cycles_per_frame, EVENT_SOUND_OFF);
+    }
+}
+
+bool save_state_file(const struct Chip8 *state, const char *filename) {
+    uint8_t buffer[SAVESTATE_SIZE];
+    FILE *fp;
+
+    save_state(state, buffer);
+
+    if ((fp = fopen(filename, "wb")) == NULL) {
+        error("Failed to open save state file", false);
+        return false;
+    }
+
+    bool ok = fwrite(buffer, 1, sizeof(buffer), fp) == sizeof(buffer);
+
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) error("Failed to write save state file", false);
+
+    return ok;
+}
+
+bool restore_state_file(struct Chip8 *state, const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        error("Failed to open save state file", false);
+        return false;
+    }
+
+    if ((size_t)st.st_size < SAVESTATE_SIZE) {
+        close(fd);
+        error("Not a save state", false);
+        return false;
+    }
+
+    void *mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        error("Failed to map save state file", false);
+        return false;
+    }
+
+    bool ok = restore_state(state, mapping, st.st_size);
+
+    munmap(mapping, st.st_size);
+    return ok;
+}
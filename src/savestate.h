@@ -0,0 +1,64 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include "chip8.h"
+
+// Save states: a small header plus a fixed-layout body, CRC-32C checked.
+// Fields are stored in host byte order at fixed offsets, so a snapshot file
+// can be mmap()ed and restored straight from the mapping with no parsing.
+// The display is kept as its 32 packed 1bpp rows (256 bytes).
+
+#define SAVESTATE_MAGIC 0x53533843 // "C8SS" little-endian; reads back swapped on big-endian hosts
+#define SAVESTATE_VERSION 2
+
+struct SavestateHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    uint32_t body_size;
+    uint32_t crc32c; // Of the body
+};
+
+// Version 2 body (v2 widened the RNG state to 64 bits). Append fields and
+// bump the version; never reorder.
+struct SavestateBody {
+    uint64_t cycles;
+    uint64_t delay_expiry;
+    uint64_t sound_expiry;
+    uint64_t rng_state;
+    uint64_t display[SCREEN_HEIGHT];
+
+    uint16_t stack[16];
+    uint16_t index;
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t keypad; // Bit n set while key n is held
+
+    uint32_t cycles_per_frame;
+    uint32_t reserved0;
+
+    uint8_t registers[16];
+    uint8_t sp;
+    uint8_t reserved[7];
+
+    uint8_t memory[MEMORY_SIZE];
+};
+
+#define SAVESTATE_SIZE (sizeof(struct SavestateHeader) + sizeof(struct SavestateBody))
+
+uint32_t crc32c(const void *data, size_t size);
+
+void save_state(const struct Chip8 *state, void *buffer); // Writes SAVESTATE_SIZE bytes
+
+// Validates magic, version, sizes and CRC before touching `state`; returns false
+// (leaving `state` as it was) if the snapshot is unusable
+bool restore_state(struct Chip8 *state, const void *buffer, size_t size);
+
+// Body only, unchecked: for in-memory snapshots that never leave the process
+void save_state_body(const struct Chip8 *state, struct SavestateBody *body);
+void restore_state_body(struct Chip8 *state, const struct SavestateBody *body);
+
+bool save_state_file(const struct Chip8 *state, const char *filename);
+bool restore_state_file(struct Chip8 *state, const char *filename); // Restores from an mmap() of the file
+
+#endif
@@ -0,0 +1,55 @@
+#include "scheduler.h"
+
+#include <errno.h>
+#include <time.h>
+
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000ULL;
+    ts.tv_nsec = deadline_ns % 1000000000ULL;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+void initialise_scheduler(struct Scheduler *scheduler, unsigned int hz) {
+    scheduler->period_ns = 1000000000ULL / hz;
+    scheduler->next_deadline_ns = monotonic_ns() + scheduler->period_ns;
+
+    scheduler->frames = 0;
+    scheduler->missed_deadlines = 0;
+    scheduler->dropped_frames = 0;
+}
+
+unsigned int wait_frame(struct Scheduler *scheduler) {
+    uint64_t now = monotonic_ns();
+    unsigned int due = 1;
+
+    if (now < scheduler->next_deadline_ns) {
+        sleep_until(scheduler->next_deadline_ns);
+        scheduler->next_deadline_ns += scheduler->period_ns;
+    } else {
+        // Late: run every frame we owe, up to the catch-up limit
+        uint64_t behind = (now - scheduler->next_deadline_ns) / scheduler->period_ns + 1;
+
+        scheduler->missed_deadlines++;
+
+        if (behind > MAX_CATCH_UP_FRAMES) {
+            // Too far behind (debugger, suspended VM): drop the rest and restart the grid from now
+            scheduler->dropped_frames += behind - MAX_CATCH_UP_FRAMES;
+            scheduler->next_deadline_ns = now + scheduler->period_ns;
+            due = MAX_CATCH_UP_FRAMES;
+        } else {
+            scheduler->next_deadline_ns += behind * scheduler->period_ns;
+            due = behind;
+        }
+    }
+
+    scheduler->frames += due;
+    return due;
+}
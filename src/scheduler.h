@@ -0,0 +1,28 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+// Wall-clock frame pacing. Deadlines are absolute (start + n * period), so
+// sleep overshoot never accumulates into drift.
+
+#define MAX_CATCH_UP_FRAMES 4 // Beyond this many late frames, drop them and resync
+
+struct Scheduler {
+    uint64_t period_ns;
+    uint64_t next_deadline_ns;
+
+    uint64_t frames;           // Frames handed out by wait_frame()
+    uint64_t missed_deadlines; // Calls that found the deadline already passed
+    uint64_t dropped_frames;   // Late frames skipped instead of caught up
+};
+
+uint64_t monotonic_ns();
+
+void initialise_scheduler(struct Scheduler *scheduler, unsigned int hz);
+
+// Sleeps until the next frame deadline and returns how many frames are due:
+// normally 1, more when catching up after a stall (at most MAX_CATCH_UP_FRAMES)
+unsigned int wait_frame(struct Scheduler *scheduler);
+
+#endif